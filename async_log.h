@@ -0,0 +1,374 @@
+// 异步日志：调用线程只把一行日志snprintf到自己的单生产者环形缓冲里(无锁、不分配内存、满了丢弃并计数)，
+// 后台线程取出所有线程的缓冲，攒成大块后一次write到stdout；没有日志时睡在条件变量上，由写入方按需唤醒
+// 编译期过滤：-DASYNC_LOG_LEVEL=LOG_LEVEL_INFO 等，低于该级别的LOGx连参数都不会求值；
+// 运行期还可以用AsyncLog::SetLevel()再调高，基准测试时关掉调试日志而不必重新编译
+// 限流：LOGx_RATE(n, ...) 每个调用点每秒最多输出n条，被丢弃的条数附在下一条输出后面
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef ASYNC_LOG_LEVEL
+#define ASYNC_LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+const size_t LOG_RING_SIZE   = 1 << 16; // 每个线程的环形缓冲大小，必须是2的幂
+const size_t LOG_LINE_MAX    = 512;     // 单行最大长度，超出截断
+const size_t LOG_WRITE_CHUNK = 1 << 16; // 后台线程攒够这么多再write
+
+class LogRateLimiter {
+public:
+    explicit LogRateLimiter(uint32_t perSecond) : perSecond_(perSecond) {}
+
+    // 允许输出时返回true，suppressed带回上次允许以来被限流丢弃的条数
+    bool Allow(uint64_t& suppressed)
+    {
+        uint64_t now   = NowSec();
+        uint64_t start = windowStart_.load(std::memory_order_relaxed);
+        if (now != start && windowStart_.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+            count_.store(0, std::memory_order_relaxed);
+        }
+        if (count_.fetch_add(1, std::memory_order_relaxed) >= perSecond_) {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    static uint64_t NowSec()
+    {
+        return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    const uint32_t        perSecond_;
+    std::atomic<uint64_t> windowStart_{0};
+    std::atomic<uint32_t> count_{0};
+    std::atomic<uint64_t> suppressed_{0};
+};
+
+class AsyncLog {
+public:
+    // 故意不释放：线程局部缓冲的析构可能晚于静态对象，进程退出时由atexit刷一次
+    static AsyncLog& GetInstance()
+    {
+        static AsyncLog* instance = new AsyncLog();
+        return *instance;
+    }
+
+    void Write(int level, uint64_t suppressed, const char* fmt, ...) __attribute__((format(printf, 4, 5)))
+    {
+        LogRing* ring = LocalRing();
+        if (ring == nullptr) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        char     line[LOG_LINE_MAX];
+        uint64_t us  = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_)
+                          .count();
+        int      len = snprintf(line, sizeof(line), "[%c %llu.%06llu %d] ", "DIWE"[level],
+                                (unsigned long long)(us / 1000000), (unsigned long long)(us % 1000000), ring->tid);
+        va_list  args;
+        va_start(args, fmt);
+        len += vsnprintf(line + len, sizeof(line) - len, fmt, args);
+        va_end(args);
+        if (len > (int)sizeof(line) - 32) {
+            len = sizeof(line) - 32;
+        }
+        if (suppressed > 0) {
+            len += snprintf(line + len, sizeof(line) - len, " (%llu suppressed)", (unsigned long long)suppressed);
+        }
+        line[len++] = '\n';
+        ring->Push(line, len);
+        // 与WriterMain睡前的fence配对：要么后台线程再检查时看到这条日志，要么这里看到它要睡并唤醒它
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        WakeWriter();
+    }
+
+    // 阻塞到调用前写入的日志都已输出
+    void Flush()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        uint64_t                     target = ++flushRequested_;
+        wakeup_.notify_one();
+        flushed_.wait(lock, [&]() { return flushDone_ >= target; });
+    }
+
+    uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    // 运行期级别，只能比ASYNC_LOG_LEVEL更严格；常量初始化，不经过GetInstance
+    static void SetLevel(int level) { RuntimeLevel().store(level, std::memory_order_relaxed); }
+    static int  Level() { return RuntimeLevel().load(std::memory_order_relaxed); }
+
+private:
+    // 单生产者(所属线程)单消费者(后台线程)，每条记录为4字节长度+内容
+    struct LogRing {
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool>     closed{false};
+        int                   tid = static_cast<int>(syscall(SYS_gettid));
+        char                  data[LOG_RING_SIZE];
+
+        void Push(const char* line, uint32_t len)
+        {
+            uint64_t pos = head.load(std::memory_order_relaxed);
+            if (LOG_RING_SIZE - (pos - tail.load(std::memory_order_acquire)) < sizeof(len) + len) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            CopyIn(pos, &len, sizeof(len));
+            CopyIn(pos + sizeof(len), line, len);
+            head.store(pos + sizeof(len) + len, std::memory_order_release);
+        }
+        void CopyIn(uint64_t pos, const void* src, size_t len)
+        {
+            size_t off   = pos & (LOG_RING_SIZE - 1);
+            size_t first = std::min(len, LOG_RING_SIZE - off);
+            memcpy(data + off, src, first);
+            memcpy(data, static_cast<const char*>(src) + first, len - first);
+        }
+        void CopyOut(uint64_t pos, void* dst, size_t len) const
+        {
+            size_t off   = pos & (LOG_RING_SIZE - 1);
+            size_t first = std::min(len, LOG_RING_SIZE - off);
+            memcpy(dst, data + off, first);
+            memcpy(static_cast<char*>(dst) + first, data, len - first);
+        }
+    };
+
+    // 线程退出时只做标记，由后台线程取完剩余日志后释放；之后本线程不能再用这块缓冲
+    struct RingHolder {
+        LogRing* ring = nullptr;
+        ~RingHolder()
+        {
+            RingGone() = true;
+            if (ring != nullptr) {
+                ring->closed.store(true, std::memory_order_release);
+                ring = nullptr;
+                GetInstance().WakeWriter();
+            }
+        }
+    };
+
+    // 平凡析构的线程局部标记，holder析构后仍可读；更晚析构的线程局部对象里再打日志时据此丢弃
+    static bool& RingGone()
+    {
+        static thread_local bool gone = false;
+        return gone;
+    }
+
+    AsyncLog() : start_(std::chrono::steady_clock::now())
+    {
+        out_.reserve(LOG_WRITE_CHUNK + LOG_LINE_MAX);
+        std::thread(&AsyncLog::WriterMain, this).detach();
+        atexit([]() { GetInstance().Flush(); });
+    }
+
+    static std::atomic<int>& RuntimeLevel()
+    {
+        static std::atomic<int> level{ASYNC_LOG_LEVEL};
+        return level;
+    }
+
+    // 本线程的holder已析构时返回nullptr
+    LogRing* LocalRing()
+    {
+        if (RingGone()) {
+            return nullptr;
+        }
+        static thread_local RingHolder holder;
+        if (holder.ring == nullptr) {
+            holder.ring = new LogRing();
+            std::lock_guard<std::mutex> lock(mutex_);
+            rings_.push_back(holder.ring);
+        }
+        return holder.ring;
+    }
+
+    // 后台线程睡着时才加锁唤醒，忙时写日志只多一次原子读
+    void WakeWriter()
+    {
+        if (sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            wakeup_.notify_one();
+        }
+    }
+
+    // 持mutex_调用
+    bool HasPending() const
+    {
+        for (auto ring : rings_) {
+            if (ring->head.load(std::memory_order_acquire) != ring->tail.load(std::memory_order_relaxed) ||
+                ring->closed.load(std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WriterMain()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            uint64_t target = flushRequested_;
+            // 拷贝出来再解锁处理，注册新线程不会被write阻塞
+            snapshot_.assign(rings_.begin(), rings_.end());
+            lock.unlock();
+            bool busy = false;
+            for (auto ring : snapshot_) {
+                busy |= Drain(*ring);
+            }
+            WriteOut();
+            lock.lock();
+            ReapClosed();
+            if (target > flushDone_) {
+                flushDone_ = target;
+                flushed_.notify_all();
+            }
+            if (!busy && flushRequested_ == target) {
+                // 先登记要睡再检查一遍所有缓冲，与Write中的fence配对，不会漏掉睡前刚写入的日志
+                sleeping_.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!HasPending()) {
+                    wakeup_.wait(lock, [&]() {
+                        return !sleeping_.load(std::memory_order_relaxed) || flushRequested_ != target;
+                    });
+                }
+                sleeping_.store(false, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 返回是否取到了日志
+    bool Drain(LogRing& ring)
+    {
+        uint64_t pos  = ring.tail.load(std::memory_order_relaxed);
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        if (pos == head) {
+            ReportDropped(ring);
+            return false;
+        }
+        while (pos != head) {
+            uint32_t len;
+            ring.CopyOut(pos, &len, sizeof(len));
+            size_t size = out_.size();
+            out_.resize(size + len);
+            ring.CopyOut(pos + sizeof(len), &out_[size], len);
+            pos += sizeof(len) + len;
+            if (out_.size() >= LOG_WRITE_CHUNK) {
+                ring.tail.store(pos, std::memory_order_release);
+                WriteOut();
+            }
+        }
+        ring.tail.store(pos, std::memory_order_release);
+        ReportDropped(ring);
+        return true;
+    }
+
+    void ReportDropped(LogRing& ring)
+    {
+        uint64_t dropped = ring.dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            dropped_.fetch_add(dropped, std::memory_order_relaxed);
+            char line[LOG_LINE_MAX];
+            int  len = snprintf(line, sizeof(line), "[W log] thread %d dropped %llu lines, buffer full\n", ring.tid,
+                                (unsigned long long)dropped);
+            out_.append(line, len);
+        }
+    }
+
+    void WriteOut()
+    {
+        size_t done = 0;
+        while (done < out_.size()) {
+            ssize_t n = write(STDOUT_FILENO, out_.data() + done, out_.size() - done);
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+        }
+        out_.clear();
+    }
+
+    // 持mutex_调用，已退出且取空的线程缓冲在这里释放
+    void ReapClosed()
+    {
+        for (size_t i = 0; i < rings_.size();) {
+            LogRing* ring = rings_[i];
+            if (ring->closed.load(std::memory_order_acquire) &&
+                ring->tail.load(std::memory_order_relaxed) == ring->head.load(std::memory_order_acquire)) {
+                ReportDropped(*ring);
+                WriteOut();
+                delete ring;
+                rings_[i] = rings_.back();
+                rings_.pop_back();
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    const std::chrono::steady_clock::time_point start_;
+    std::mutex                                  mutex_; // 保护rings_和flush计数
+    std::condition_variable                     wakeup_;
+    std::condition_variable                     flushed_;
+    std::vector<LogRing*>                       rings_;
+    uint64_t                                    flushRequested_ = 0;
+    uint64_t                                    flushDone_      = 0;
+    std::atomic<uint64_t>                       dropped_{0};
+    std::atomic<bool>                           sleeping_{false}; // 后台线程已无事可做，准备或正在等wakeup_
+    std::vector<LogRing*>                       snapshot_; // 以下仅后台线程使用
+    std::string                                 out_;
+};
+
+#define ASYNC_LOG(level, ...)                                                                                          \
+    do {                                                                                                               \
+        if (level >= ASYNC_LOG_LEVEL && level >= AsyncLog::Level()) {                                                  \
+            AsyncLog::GetInstance().Write(level, 0, __VA_ARGS__);                                                      \
+        }                                                                                                              \
+    } while (0)
+
+#define ASYNC_LOG_RATE(level, perSecond, ...)                                                                          \
+    do {                                                                                                               \
+        if (level >= ASYNC_LOG_LEVEL && level >= AsyncLog::Level()) {                                                  \
+            static LogRateLimiter logLimiter(perSecond);                                                               \
+            uint64_t              logSuppressed = 0;                                                                   \
+            if (logLimiter.Allow(logSuppressed)) {                                                                     \
+                AsyncLog::GetInstance().Write(level, logSuppressed, __VA_ARGS__);                                      \
+            }                                                                                                          \
+        }                                                                                                              \
+    } while (0)
+
+#define LOGD(...) ASYNC_LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOGI(...) ASYNC_LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOGW(...) ASYNC_LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOGE(...) ASYNC_LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#define LOGD_RATE(n, ...) ASYNC_LOG_RATE(LOG_LEVEL_DEBUG, n, __VA_ARGS__)
+#define LOGI_RATE(n, ...) ASYNC_LOG_RATE(LOG_LEVEL_INFO, n, __VA_ARGS__)
+#define LOGW_RATE(n, ...) ASYNC_LOG_RATE(LOG_LEVEL_WARN, n, __VA_ARGS__)
+#define LOGE_RATE(n, ...) ASYNC_LOG_RATE(LOG_LEVEL_ERROR, n, __VA_ARGS__)
+
+#endif // ASYNC_LOG_H
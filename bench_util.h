@@ -0,0 +1,51 @@
+// 基准测试公用的小工具：
+// cpuRelax():        自旋等待时提示CPU(x86 pause / arm yield)，降低功耗和对超线程兄弟核的干扰
+// BENCH_COUNT_ALLOCS: 在包含本头文件前定义后，替换全局operator new/delete，把堆分配次数计入allocCount；
+//                     全局operator new只能有一份定义，每个程序只能在一个翻译单元里开启
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+inline void cpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+#endif // BENCH_UTIL_H
+
+// 单独的保护宏：先被其他头文件(如lock_profiler.h)包含过，后面再定义BENCH_COUNT_ALLOCS包含也能生效
+#if defined(BENCH_COUNT_ALLOCS) && !defined(BENCH_UTIL_ALLOC_COUNTER)
+#define BENCH_UTIL_ALLOC_COUNTER
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+std::atomic<uint64_t> allocCount(0); // 堆分配次数
+
+// noinline: 避免内联后new表达式里的malloc和delete里的free被gcc误报-Wmismatched-new-delete
+__attribute__((noinline)) void* operator new(size_t size)
+{
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, size_t) noexcept
+{
+    free(ptr);
+}
+
+#endif // BENCH_COUNT_ALLOCS
@@ -0,0 +1,279 @@
+// CPU亲和性与NUMA放置：从/sys读取在线CPU、物理核和NUMA节点(不依赖libnuma)，按策略算出池里第i个线程要绑定的CPU集合
+// PLACEMENT_COMPACT:    按节点、物理核顺序依次占满，同核的超线程相邻，线程之间共享缓存
+// PLACEMENT_SCATTER:    轮流分布到各节点、各物理核，物理核用完才用超线程，缓存和内存带宽最大化
+// PLACEMENT_CPU_LIST:   按给定CPU列表轮流绑定
+// PLACEMENT_NUMA_NODES: 线程按节点分组，只限定在节点内而不绑具体CPU，任务池据此为每个节点建一个本地队列
+// 只统计当前进程允许使用(sched_getaffinity)的CPU，容器里被限制的CPU不会被分配
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <ostream>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <tuple>
+#include <vector>
+
+const int32_t THREAD_NAME_MAX = 15; // pthread_setname_np的长度上限(不含结尾0)
+
+enum class PlacementMode {
+    PLACEMENT_NONE, // 不绑定，由系统调度(原先的行为)
+    PLACEMENT_COMPACT,
+    PLACEMENT_SCATTER,
+    PLACEMENT_CPU_LIST,
+    PLACEMENT_NUMA_NODES,
+};
+
+struct PlacementPolicy {
+    PlacementMode    mode = PlacementMode::PLACEMENT_NONE;
+    std::vector<int> cpus;             // PLACEMENT_CPU_LIST使用
+    bool             keepLocal = true; // PLACEMENT_NUMA_NODES下外部线程提交的任务进入其所在节点的队列，否则轮流分配
+    std::string      namePrefix;       // 线程名前缀，为空时用池的默认前缀
+};
+
+class CpuTopology {
+public:
+    static const CpuTopology& GetInstance()
+    {
+        static CpuTopology instance;
+        return instance;
+    }
+
+    // 有可用CPU的节点数，节点序号0..NodeCount()-1，不一定等于系统的节点编号
+    int32_t                 NodeCount() const { return static_cast<int32_t>(nodes_.size()); }
+    const std::vector<int>& NodeCpus(int32_t node) const { return nodes_[node].cpus; }
+
+    // 当前线程所在的节点序号，未知时返回-1
+    int32_t CurrentNode() const
+    {
+        int cpu = sched_getcpu();
+        return cpu >= 0 && cpu < static_cast<int>(nodeOfCpu_.size()) ? nodeOfCpu_[cpu] : -1;
+    }
+
+    // 第index个线程要绑定的CPU集合，为空表示不绑定；node带回线程所属的节点序号(仅NUMA模式有意义，其余为0)
+    std::vector<int> CpusFor(const PlacementPolicy& policy, int32_t index, int32_t& node) const
+    {
+        node = 0;
+        switch (policy.mode) {
+            case PlacementMode::PLACEMENT_COMPACT:
+                return compact_.empty() ? std::vector<int>() : std::vector<int>{compact_[index % compact_.size()]};
+            case PlacementMode::PLACEMENT_SCATTER:
+                return scatter_.empty() ? std::vector<int>() : std::vector<int>{scatter_[index % scatter_.size()]};
+            case PlacementMode::PLACEMENT_CPU_LIST:
+                return policy.cpus.empty() ? std::vector<int>()
+                                           : std::vector<int>{policy.cpus[index % policy.cpus.size()]};
+            case PlacementMode::PLACEMENT_NUMA_NODES:
+                if (nodes_.empty()) {
+                    return {};
+                }
+                node = index % NodeCount();
+                return nodes_[node].cpus;
+            default:
+                return {};
+        }
+    }
+
+    void DumpJson(std::ostream& os) const
+    {
+        os << "{\"nodes\":[";
+        for (size_t i = 0; i < nodes_.size(); ++i) {
+            os << (i == 0 ? "" : ",") << "{\"id\":" << nodes_[i].id << ",\"cpus\":[";
+            for (size_t j = 0; j < nodes_[i].cpus.size(); ++j) {
+                os << (j == 0 ? "" : ",") << nodes_[i].cpus[j];
+            }
+            os << "]}";
+        }
+        os << "]}\n";
+    }
+
+    // 解析"0-3,8,10-11"格式的CPU列表
+    static std::vector<int> ParseList(const std::string& text)
+    {
+        std::vector<int> cpus;
+        size_t           pos = 0;
+        while (pos < text.size()) {
+            size_t      end   = text.find(',', pos);
+            std::string range = text.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+            size_t      dash  = range.find('-');
+            if (!range.empty() && isdigit(static_cast<unsigned char>(range[0]))) {
+                int first = atoi(range.c_str());
+                int last  = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+                for (int cpu = first; cpu <= last; ++cpu) {
+                    cpus.push_back(cpu);
+                }
+            }
+            if (end == std::string::npos) {
+                break;
+            }
+            pos = end + 1;
+        }
+        return cpus;
+    }
+
+private:
+    struct Node {
+        int              id;
+        std::vector<int> cpus;
+    };
+    struct Cpu {
+        int cpu;
+        int node;    // 节点序号
+        int core;    // 节点内物理核序号
+        int sibling; // 同一物理核上的第几个超线程
+    };
+
+    CpuTopology()
+    {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return;
+        }
+        std::vector<int> online = ParseList(ReadLine("/sys/devices/system/cpu/online"));
+        online.erase(std::remove_if(online.begin(), online.end(),
+                                    [&](int cpu) { return cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed); }),
+                     online.end());
+        LoadNodes(online);
+        std::vector<Cpu> cpus;
+        for (int32_t node = 0; node < NodeCount(); ++node) {
+            std::vector<std::pair<int, int>> cores; // (package, core_id)
+            for (int cpu : nodes_[node].cpus) {
+                nodeOfCpu_.resize(std::max<size_t>(nodeOfCpu_.size(), cpu + 1), -1);
+                nodeOfCpu_[cpu] = node;
+                std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+                std::pair<int, int> key(atoi(ReadLine(dir + "physical_package_id").c_str()),
+                                        atoi(ReadLine(dir + "core_id").c_str()));
+                auto it   = std::find(cores.begin(), cores.end(), key);
+                int  core = static_cast<int>(it - cores.begin());
+                if (it == cores.end()) {
+                    cores.push_back(key);
+                }
+                auto sameCore = [&](const Cpu& c) { return c.node == node && c.core == core; };
+                int  sibling  = static_cast<int>(std::count_if(cpus.begin(), cpus.end(), sameCore));
+                cpus.push_back({cpu, node, core, sibling});
+            }
+        }
+        // compact: 节点 -> 物理核 -> 超线程；scatter: 超线程 -> 物理核 -> 节点
+        std::sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b) {
+            return std::tie(a.node, a.core, a.sibling) < std::tie(b.node, b.core, b.sibling);
+        });
+        for (auto& cpu : cpus) {
+            compact_.push_back(cpu.cpu);
+        }
+        std::sort(cpus.begin(), cpus.end(), [](const Cpu& a, const Cpu& b) {
+            return std::tie(a.sibling, a.core, a.node) < std::tie(b.sibling, b.core, b.node);
+        });
+        for (auto& cpu : cpus) {
+            scatter_.push_back(cpu.cpu);
+        }
+    }
+
+    // 没有/sys/devices/system/node(未开NUMA的内核)时当作一个节点
+    void LoadNodes(const std::vector<int>& online)
+    {
+        std::vector<int> ids;
+        if (DIR* dir = opendir("/sys/devices/system/node")) {
+            while (dirent* entry = readdir(dir)) {
+                std::string name = entry->d_name;
+                if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+                    isdigit(static_cast<unsigned char>(name[4]))) {
+                    ids.push_back(atoi(name.c_str() + 4));
+                }
+            }
+            closedir(dir);
+        }
+        std::sort(ids.begin(), ids.end());
+        for (int id : ids) {
+            std::vector<int> cpus =
+                ParseList(ReadLine("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist"));
+            auto offline = [&](int cpu) { return std::find(online.begin(), online.end(), cpu) == online.end(); };
+            cpus.erase(std::remove_if(cpus.begin(), cpus.end(), offline), cpus.end());
+            if (!cpus.empty()) {
+                nodes_.push_back({id, cpus});
+            }
+        }
+        if (nodes_.empty() && !online.empty()) {
+            nodes_.push_back({0, online});
+        }
+    }
+
+    static std::string ReadLine(const std::string& path)
+    {
+        std::ifstream file(path);
+        std::string   line;
+        std::getline(file, line);
+        return line;
+    }
+
+    std::vector<Node> nodes_;
+    std::vector<int>  nodeOfCpu_; // 按CPU编号索引，-1表示不可用
+    std::vector<int>  compact_;
+    std::vector<int>  scatter_;
+};
+
+// 绑定当前线程，cpus为空时不做任何事；成功返回0
+inline int32_t BindCurrentThread(const std::vector<int>& cpus)
+{
+    if (cpus.empty()) {
+        return 0;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// 超出长度时截断，pthread_setname_np遇到过长的名字会直接失败
+inline void SetThreadName(pthread_t thread, const std::string& name)
+{
+#ifdef __linux__
+    pthread_setname_np(thread, name.substr(0, THREAD_NAME_MAX).c_str());
+#endif
+}
+
+// 外部线程提交任务时选择的节点队列：keepLocal时取当前线程所在节点，节点没有工作线程或未知时轮流分配
+inline int32_t SubmitNodeFor(const PlacementPolicy& policy, int32_t nodeCount, std::atomic<uint32_t>& next)
+{
+    if (nodeCount <= 1) {
+        return 0;
+    }
+    if (policy.keepLocal) {
+        int32_t node = CpuTopology::GetInstance().CurrentNode();
+        if (node >= 0 && node < nodeCount) {
+            return node;
+        }
+    }
+    return next.fetch_add(1, std::memory_order_relaxed) % nodeCount;
+}
+
+// 解析命令行里的放置策略：none/compact/scatter/numa/numa-rr/cpus:0,2,4-7，无法识别返回false
+inline bool ParsePlacement(const std::string& text, PlacementPolicy& policy)
+{
+    if (text == "none") {
+        policy.mode = PlacementMode::PLACEMENT_NONE;
+    } else if (text == "compact") {
+        policy.mode = PlacementMode::PLACEMENT_COMPACT;
+    } else if (text == "scatter") {
+        policy.mode = PlacementMode::PLACEMENT_SCATTER;
+    } else if (text == "numa" || text == "numa-rr") {
+        policy.mode      = PlacementMode::PLACEMENT_NUMA_NODES;
+        policy.keepLocal = text == "numa";
+    } else if (text.compare(0, 5, "cpus:") == 0) {
+        policy.mode = PlacementMode::PLACEMENT_CPU_LIST;
+        policy.cpus = CpuTopology::ParseList(text.substr(5));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+#endif // CPU_AFFINITY_H
@@ -0,0 +1,173 @@
+// 锁竞争统计：按名字聚合每个加锁点的加锁次数、竞争次数、自旋次数以及等待/持有时间直方图，可随时导出为json
+// ProfiledLock<Lock>提供lock/try_lock/unlock，可直接替换std::lock_guard/std::unique_lock中的锁类型；
+// 与条件变量配合时改用std::condition_variable_any
+// 自旋次数由被包装的锁提供：Lock有unsigned int lock_spins()(加锁并返回退避轮数)时竞争路径改调它，否则记0
+#ifndef LOCK_PROFILER_H
+#define LOCK_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+
+const int      LOCK_PROFILE_BUCKETS     = 32; // 第i个桶记录[2^(i-1), 2^i)纳秒
+const uint64_t LOCK_PROFILE_HOLD_SAMPLE = 16; // 每16次加锁采样一次持有时间、合并一次加锁次数，省掉无竞争路径上的取时
+
+struct LockSiteStats {
+    const char*           name = nullptr;
+    std::atomic<uint64_t> acquires{0};
+    std::atomic<uint64_t> contended{0};
+    std::atomic<uint64_t> spins{0};
+    std::atomic<uint64_t> waitHist[LOCK_PROFILE_BUCKETS] = {};
+    std::atomic<uint64_t> holdHist[LOCK_PROFILE_BUCKETS] = {};
+};
+
+class LockProfiler {
+public:
+    static LockProfiler& GetInstance()
+    {
+        static LockProfiler instance;
+        return instance;
+    }
+
+    // 同名加锁点共用一份统计，统计在进程退出前一直有效，锁对象析构后仍可导出
+    LockSiteStats* GetSite(const char* name)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& site : sites_) {
+            if (strcmp(site.name, name) == 0) {
+                return &site;
+            }
+        }
+        sites_.emplace_back();
+        sites_.back().name = name;
+        return &sites_.back();
+    }
+
+    void DumpJson(std::ostream& os)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        os << "{\"locks\":[";
+        bool first = true;
+        for (auto& site : sites_) {
+            os << (first ? "" : ",") << "{\"name\":\"" << site.name << "\""
+               << ",\"acquires\":" << site.acquires.load(std::memory_order_relaxed)
+               << ",\"contended\":" << site.contended.load(std::memory_order_relaxed)
+               << ",\"spins\":" << site.spins.load(std::memory_order_relaxed) << ",\"wait_ns_log2\":";
+            DumpHist(os, site.waitHist);
+            os << ",\"hold_ns_log2_sampled\":";
+            DumpHist(os, site.holdHist);
+            os << "}";
+            first = false;
+        }
+        os << "]}\n";
+    }
+
+    static inline uint64_t NowNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    static inline int Bucket(uint64_t ns)
+    {
+        int bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+        return bucket < LOCK_PROFILE_BUCKETS ? bucket : LOCK_PROFILE_BUCKETS - 1;
+    }
+
+private:
+    LockProfiler() = default;
+
+    static void DumpHist(std::ostream& os, const std::atomic<uint64_t>* hist)
+    {
+        os << "[";
+        for (int i = 0; i < LOCK_PROFILE_BUCKETS; ++i) {
+            os << (i == 0 ? "" : ",") << hist[i].load(std::memory_order_relaxed);
+        }
+        os << "]";
+    }
+
+    std::mutex                mutex_;
+    std::deque<LockSiteStats> sites_;
+};
+
+template <class Lock, class = void> struct HasLockSpins : std::false_type {};
+template <class Lock>
+struct HasLockSpins<Lock, decltype(void(std::declval<Lock&>().lock_spins()))> : std::true_type {};
+
+template <class Lock> class ProfiledLock {
+public:
+    explicit ProfiledLock(const char* name = "unnamed") : stats_(LockProfiler::GetInstance().GetSite(name)) {}
+    ~ProfiledLock() { stats_->acquires.fetch_add(acquires_ % LOCK_PROFILE_HOLD_SAMPLE, std::memory_order_relaxed); }
+    ProfiledLock(const ProfiledLock&)            = delete;
+    ProfiledLock& operator=(const ProfiledLock&) = delete;
+
+    void lock()
+    {
+        if (lock_.try_lock()) {
+            OnAcquired();
+            return;
+        }
+        // 只做一次try_lock区分有无竞争，等待策略(自旋/睡眠)交给被包装的锁自己，统计到的就是它的真实等待时间
+        uint64_t begin = LockProfiler::NowNs();
+        uint64_t spins = LockAndCountSpins(HasLockSpins<Lock>());
+        stats_->contended.fetch_add(1, std::memory_order_relaxed);
+        if (spins != 0) {
+            stats_->spins.fetch_add(spins, std::memory_order_relaxed);
+        }
+        stats_->waitHist[LockProfiler::Bucket(LockProfiler::NowNs() - begin)].fetch_add(1, std::memory_order_relaxed);
+        OnAcquired();
+    }
+
+    bool try_lock()
+    {
+        if (!lock_.try_lock()) {
+            return false;
+        }
+        OnAcquired();
+        return true;
+    }
+
+    void unlock()
+    {
+        if (holdBegin_ != 0) {
+            stats_->holdHist[LockProfiler::Bucket(LockProfiler::NowNs() - holdBegin_)].fetch_add(
+                1, std::memory_order_relaxed);
+        }
+        lock_.unlock();
+    }
+
+private:
+    uint64_t LockAndCountSpins(std::true_type) { return lock_.lock_spins(); }
+    uint64_t LockAndCountSpins(std::false_type)
+    {
+        lock_.lock();
+        return 0;
+    }
+
+    // 持锁状态下调用，acquires_和holdBegin_只被持锁者读写，无竞争路径上不写同名锁共享的统计
+    inline void OnAcquired()
+    {
+        if (++acquires_ % LOCK_PROFILE_HOLD_SAMPLE != 0) {
+            holdBegin_ = 0;
+            return;
+        }
+        stats_->acquires.fetch_add(LOCK_PROFILE_HOLD_SAMPLE, std::memory_order_relaxed);
+        holdBegin_ = LockProfiler::NowNs();
+    }
+
+    Lock           lock_;
+    LockSiteStats* stats_;
+    uint64_t       acquires_  = 0; // 本实例的加锁次数，凑够LOCK_PROFILE_HOLD_SAMPLE次合并进stats_，析构时合并余数
+    uint64_t       holdBegin_ = 0;
+};
+
+using ProfiledMutex = ProfiledLock<std::mutex>;
+
+#endif // LOCK_PROFILER_H
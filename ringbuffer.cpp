@@ -1,12 +1,117 @@
+#define BENCH_COUNT_ALLOCS // 统计每条消息的堆分配次数
+#include "bench_util.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <deque>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <mutex>
+#include <pthread.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <thread>
+#include <type_traits>
 #include <unistd.h>
+#include <vector>
 
-template <class T> class RingBuffer {
+const unsigned int CACHE_LINE_SIZE = 64;
+
+inline unsigned int roundUpPow2(unsigned int size)
+{
+    unsigned int n = 1;
+    while (n < size) {
+        n <<= 1;
+    }
+    return n;
+}
+
+const int WAIT_SPIN_COUNT = 1 << 10;
+
+// 等待策略：wait(ready)阻塞到ready()为真，notify()由对端在发布索引后调用
+// 忙等：延时最低，一直占满一个核
+struct BusySpinWait {
+    template <class Pred> void wait(Pred ready)
+    {
+        while (!ready()) {
+            cpuRelax();
+        }
+    }
+    void notify() {}
+};
+
+// 先自旋，再不断让出cpu
+struct YieldWait {
+    template <class Pred> void wait(Pred ready)
+    {
+        for (int i = 0; !ready(); ++i) {
+            if (i < WAIT_SPIN_COUNT) {
+                cpuRelax();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+    void notify() {}
+};
+
+// 先自旋，再在futex上睡眠；对端只有在确实有人睡着时才发起唤醒系统调用
+class ParkWait {
 public:
-    RingBuffer(unsigned size) : m_size(size), m_front(0), m_rear(0) { m_data = new T[size]; }
+    template <class Pred> void wait(Pred ready)
+    {
+        for (int i = 0; i < WAIT_SPIN_COUNT; ++i) {
+            if (ready()) {
+                return;
+            }
+            cpuRelax();
+        }
+        while (!ready()) {
+            m_parked.store(1, std::memory_order_relaxed);
+            // 与notify()中的fence配对：要么这里看到新索引，要么对端看到m_parked == 1
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ready()) {
+                m_parked.store(0, std::memory_order_relaxed);
+                return;
+            }
+            syscall(SYS_futex, reinterpret_cast<int*>(&m_parked), FUTEX_WAIT_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+    }
+
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_parked.load(std::memory_order_relaxed) != 0) {
+            m_parked.store(0, std::memory_order_relaxed);
+            syscall(SYS_futex, reinterpret_cast<int*>(&m_parked), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+    }
+
+private:
+    std::atomic<int> m_parked{0};
+};
+
+// 一读一写(SPSC)：m_rear只由生产者写，m_front只由消费者写，两者各占一个cache line，
+// 通过acquire/release发布槽位；索引单调递增，容量取2的幂，用掩码代替取模
+// CachedIndex: 生产者缓存消费者索引、消费者缓存生产者索引，只有看起来满/空时才去读对端的cache line
+// Wait: push_wait()/pop_wait()在满/空时采用的等待策略
+template <class T, bool CachedIndex = true, class Wait = BusySpinWait> class RingBuffer {
+public:
+    RingBuffer(unsigned size)
+        : m_size(roundUpPow2(size)), m_mask(m_size - 1), m_front(0), m_rearCache(0), m_rear(0), m_frontCache(0)
+    {
+        m_data = new T[m_size];
+    }
 
     ~RingBuffer()
     {
@@ -16,44 +121,693 @@ public:
         }
     }
 
-    inline bool isEmpty() const { return m_front == m_rear; }
+    RingBuffer(const RingBuffer&)            = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    inline bool isEmpty() const
+    {
+        return m_front.load(std::memory_order_acquire) == m_rear.load(std::memory_order_acquire);
+    }
 
-    inline bool isFull() const { return m_front == (m_rear + 1) % m_size; }
+    inline bool isFull() const
+    {
+        return m_rear.load(std::memory_order_acquire) - m_front.load(std::memory_order_acquire) == m_size;
+    }
 
     bool push(T& val)
     {
-        if (isFull()) {
+        unsigned int rear = m_rear.load(std::memory_order_relaxed);
+        if (writableFor(rear, 1) == 0) {
             return false;
         }
-        // m_data[m_rear] = std::move(val);
-        m_data[m_rear] = val;
-        m_rear         = (m_rear + 1) % m_size;
+        m_data[rear & m_mask] = val;
+        m_rear.store(rear + 1, std::memory_order_release);
+        m_notEmpty.notify();
+        return true;
+    }
+
+    bool push(T&& val)
+    {
+        unsigned int rear = m_rear.load(std::memory_order_relaxed);
+        if (writableFor(rear, 1) == 0) {
+            return false;
+        }
+        m_data[rear & m_mask] = std::move(val);
+        m_rear.store(rear + 1, std::memory_order_release);
+        m_notEmpty.notify();
         return true;
     }
 
     inline bool pop(T& value)
     {
-        if (isEmpty()) {
+        unsigned int front = m_front.load(std::memory_order_relaxed);
+        if (readableFor(front, 1) == 0) {
+            return false;
+        }
+        value = std::move(m_data[front & m_mask]);
+        m_front.store(front + 1, std::memory_order_release);
+        m_notFull.notify();
+        return true;
+    }
+
+    // 阻塞版本：满/空时按Wait策略等待
+    template <class U> void push_wait(U&& val)
+    {
+        while (!push(std::forward<U>(val))) {
+            m_notFull.wait([this]() { return !isFull(); });
+        }
+    }
+
+    void pop_wait(T& value)
+    {
+        while (!pop(value)) {
+            m_notEmpty.wait([this]() { return !isEmpty(); });
+        }
+    }
+
+    // 批量移入vals[0, n)中能放下的部分，只发布一次m_rear，返回实际写入个数
+    unsigned int push_n(T* vals, unsigned int n)
+    {
+        unsigned int rear = m_rear.load(std::memory_order_relaxed);
+        n                 = std::min(n, writableFor(rear, n));
+        for (unsigned int i = 0; i < n; ++i) {
+            m_data[(rear + i) & m_mask] = std::move(vals[i]);
+        }
+        if (n > 0) {
+            m_rear.store(rear + n, std::memory_order_release);
+            m_notEmpty.notify();
+        }
+        return n;
+    }
+
+    // 批量移出最多n个元素到values，只发布一次m_front，返回实际读出个数
+    unsigned int pop_n(T* values, unsigned int n)
+    {
+        unsigned int front = m_front.load(std::memory_order_relaxed);
+        n                  = std::min(n, readableFor(front, n));
+        for (unsigned int i = 0; i < n; ++i) {
+            values[i] = std::move(m_data[(front + i) & m_mask]);
+        }
+        if (n > 0) {
+            m_front.store(front + n, std::memory_order_release);
+            m_notFull.notify();
+        }
+        return n;
+    }
+
+    // 零拷贝写：返回下一个可写槽位供生产者原地填充，commit()后对消费者可见；队列满返回nullptr
+    // 槽位对象构造一次后一直复用，填充时应复用其已有的缓冲区
+    T* reserve()
+    {
+        unsigned int rear = m_rear.load(std::memory_order_relaxed);
+        if (writableFor(rear, 1) == 0) {
+            return nullptr;
+        }
+        return &m_data[rear & m_mask];
+    }
+
+    void commit()
+    {
+        m_rear.store(m_rear.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        m_notEmpty.notify();
+    }
+
+    // 零拷贝读：返回队头槽位供消费者原地读取，release()后归还给生产者；队列空返回nullptr
+    T* peek()
+    {
+        unsigned int front = m_front.load(std::memory_order_relaxed);
+        if (readableFor(front, 1) == 0) {
+            return nullptr;
+        }
+        return &m_data[front & m_mask];
+    }
+
+    void release()
+    {
+        m_front.store(m_front.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        m_notFull.notify();
+    }
+
+    inline unsigned int front() const { return m_front.load(std::memory_order_relaxed) & m_mask; }
+
+    inline unsigned int rear() const { return m_rear.load(std::memory_order_relaxed) & m_mask; }
+
+    inline unsigned int size() const { return m_size; }
+
+private:
+    // 仅生产者调用：返回可写槽位数，缓存的消费者索引不足want个时才重新读取
+    inline unsigned int writableFor(unsigned int rear, unsigned int want)
+    {
+        if (!CachedIndex) {
+            return m_size - (rear - m_front.load(std::memory_order_acquire));
+        }
+        unsigned int writable = m_size - (rear - m_frontCache);
+        if (writable >= want) {
+            return writable;
+        }
+        m_frontCache = m_front.load(std::memory_order_acquire);
+        return m_size - (rear - m_frontCache);
+    }
+
+    // 仅消费者调用：返回可读元素数，缓存的生产者索引不足want个时才重新读取
+    inline unsigned int readableFor(unsigned int front, unsigned int want)
+    {
+        if (!CachedIndex) {
+            return m_rear.load(std::memory_order_acquire) - front;
+        }
+        unsigned int readable = m_rearCache - front;
+        if (readable >= want) {
+            return readable;
+        }
+        m_rearCache = m_rear.load(std::memory_order_acquire);
+        return m_rearCache - front;
+    }
+
+    const unsigned int m_size;
+    const unsigned int m_mask;
+    T*                 m_data;
+
+    // 消费者独占的cache line
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned int> m_front;
+    unsigned int m_rearCache;
+    // 生产者独占的cache line
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned int> m_rear;
+    unsigned int m_frontCache;
+    // 消费者在m_notEmpty上等待，生产者在m_notFull上等待
+    alignas(CACHE_LINE_SIZE) Wait m_notEmpty;
+    alignas(CACHE_LINE_SIZE) Wait m_notFull;
+};
+
+// 多读多写(MPMC)：每个槽位带序号，生产者/消费者各自CAS抢占m_rear/m_front，数据由槽位序号发布，无全局锁
+// 槽位序号 == pos 表示可写，== pos + 1 表示可读，读完置为 pos + m_size 留给下一圈的生产者
+template <class T> class MpmcRingBuffer {
+public:
+    MpmcRingBuffer(unsigned size) : m_size(roundUpPow2(size)), m_mask(m_size - 1), m_front(0), m_rear(0)
+    {
+        m_slots = new Slot[m_size];
+        for (unsigned int i = 0; i < m_size; ++i) {
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~MpmcRingBuffer()
+    {
+        if (m_slots != nullptr) {
+            delete[] m_slots;
+            m_slots = nullptr;
+        }
+    }
+
+    MpmcRingBuffer(const MpmcRingBuffer&)            = delete;
+    MpmcRingBuffer& operator=(const MpmcRingBuffer&) = delete;
+
+    // 并发下仅为近似值
+    inline bool isEmpty() const
+    {
+        return m_front.load(std::memory_order_acquire) == m_rear.load(std::memory_order_acquire);
+    }
+
+    inline bool isFull() const
+    {
+        return m_rear.load(std::memory_order_acquire) - m_front.load(std::memory_order_acquire) >= m_size;
+    }
+
+    bool push(T& val)
+    {
+        unsigned int pos = m_rear.load(std::memory_order_relaxed);
+        while (true) {
+            Slot&        slot = m_slots[pos & m_mask];
+            unsigned int seq  = slot.seq.load(std::memory_order_acquire);
+            int          diff = static_cast<int>(seq - pos);
+            if (diff == 0) {
+                if (m_rear.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.data = val;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // 该槽位上一圈还没被读走，队列满
+                return false;
+            } else {
+                pos = m_rear.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool pop(T& value)
+    {
+        unsigned int pos = m_front.load(std::memory_order_relaxed);
+        while (true) {
+            Slot&        slot = m_slots[pos & m_mask];
+            unsigned int seq  = slot.seq.load(std::memory_order_acquire);
+            int          diff = static_cast<int>(seq - (pos + 1));
+            if (diff == 0) {
+                if (m_front.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    value = slot.data;
+                    slot.seq.store(pos + m_size, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // 该槽位还没写入，队列空
+                return false;
+            } else {
+                pos = m_front.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    inline unsigned int size() const { return m_size; }
+
+private:
+    struct Slot {
+        std::atomic<unsigned int> seq;
+        T                         data;
+    };
+
+    const unsigned int m_size;
+    const unsigned int m_mask;
+    Slot*              m_slots;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned int> m_front;
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned int> m_rear;
+};
+
+// MPMC对比基线：std::mutex保护的std::deque
+template <class T> class MutexQueue {
+public:
+    MutexQueue(unsigned size) : m_size(size) {}
+
+    bool push(T& val)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.size() >= m_size) {
+            return false;
+        }
+        m_queue.push_back(val);
+        return true;
+    }
+
+    bool pop(T& value)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.empty()) {
+            return false;
+        }
+        value = m_queue.front();
+        m_queue.pop_front();
+        return true;
+    }
+
+    inline unsigned int size() const { return m_size; }
+
+private:
+    const unsigned int m_size;
+    std::mutex         m_mutex;
+    std::deque<T>      m_queue;
+};
+
+// 一读一写的变长字节环：每条记录为 [uint32_t 长度][4字节填充][数据]，按8字节对齐
+// 同一块memfd在虚拟地址上背靠背映射两次，跨越环尾的记录也是一段连续内存，读写都不用拆分/拼接
+class ByteRingBuffer {
+public:
+    static const uint32_t HEADER_SIZE = 8;
+
+    ByteRingBuffer(size_t size) : m_front(0), m_rearCache(0), m_rear(0), m_frontCache(0)
+    {
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        m_size          = pageSize;
+        while (m_size < size) {
+            m_size <<= 1;
+        }
+        m_mask = m_size - 1;
+
+        int fd = memfd_create("ringbuffer", MFD_CLOEXEC);
+        if (fd < 0) {
+            perror("memfd_create");
+            return;
+        }
+        if (ftruncate(fd, m_size) != 0) {
+            perror("ftruncate");
+            close(fd);
+            return;
+        }
+        // 先占一段2倍大小的地址空间，再把同一个fd固定映射到前后两半
+        void* base = mmap(nullptr, m_size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            perror("mmap reserve");
+            close(fd);
+            return;
+        }
+        uint8_t* addr = static_cast<uint8_t*>(base);
+        if (mmap(addr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+            mmap(addr + m_size, m_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+            perror("mmap mirror");
+            munmap(base, m_size * 2);
+            close(fd);
+            return;
+        }
+        close(fd);
+        m_data = addr;
+    }
+
+    ~ByteRingBuffer()
+    {
+        if (m_data != nullptr) {
+            munmap(m_data, m_size * 2);
+            m_data = nullptr;
+        }
+    }
+
+    ByteRingBuffer(const ByteRingBuffer&)            = delete;
+    ByteRingBuffer& operator=(const ByteRingBuffer&) = delete;
+
+    inline bool valid() const { return m_data != nullptr; }
+
+    // 单条记录允许的最大数据长度
+    inline size_t maxRecord() const { return m_size - HEADER_SIZE; }
+
+    // 预留len字节的连续可写空间，原地填充后commit(len)；空间不足返回nullptr
+    uint8_t* reserve(uint32_t len)
+    {
+        uint64_t rear = m_rear.load(std::memory_order_relaxed);
+        if (writableFor(rear, footprint(len)) < footprint(len)) {
+            return nullptr;
+        }
+        return m_data + (rear & m_mask) + HEADER_SIZE;
+    }
+
+    void commit(uint32_t len)
+    {
+        uint64_t rear = m_rear.load(std::memory_order_relaxed);
+        memcpy(m_data + (rear & m_mask), &len, sizeof(len));
+        m_rear.store(rear + footprint(len), std::memory_order_release);
+    }
+
+    bool write(const void* data, uint32_t len)
+    {
+        uint8_t* ptr = reserve(len);
+        if (ptr == nullptr) {
             return false;
         }
-        // value   = std::move(m_data[m_front]);
+        memcpy(ptr, data, len);
+        commit(len);
+        return true;
+    }
+
+    // 返回下一条记录在环内的起始地址，即使跨越环尾也是连续的；用完release()；空返回nullptr
+    const uint8_t* peek(uint32_t* len)
+    {
+        uint64_t front = m_front.load(std::memory_order_relaxed);
+        if (readableFor(front) == 0) {
+            return nullptr;
+        }
+        const uint8_t* record = m_data + (front & m_mask);
+        memcpy(len, record, sizeof(*len));
+        m_peekSize = footprint(*len);
+        return record + HEADER_SIZE;
+    }
+
+    void release() { m_front.store(m_front.load(std::memory_order_relaxed) + m_peekSize, std::memory_order_release); }
+
+    inline size_t size() const { return m_size; }
+
+    inline const uint8_t* data() const { return m_data; }
+
+private:
+    static inline uint64_t footprint(uint32_t len) { return HEADER_SIZE + ((static_cast<uint64_t>(len) + 7) & ~7ull); }
+
+    // 仅生产者调用
+    inline uint64_t writableFor(uint64_t rear, uint64_t want)
+    {
+        uint64_t writable = m_size - (rear - m_frontCache);
+        if (writable >= want) {
+            return writable;
+        }
+        m_frontCache = m_front.load(std::memory_order_acquire);
+        return m_size - (rear - m_frontCache);
+    }
+
+    // 仅消费者调用
+    inline uint64_t readableFor(uint64_t front)
+    {
+        if (m_rearCache != front) {
+            return m_rearCache - front;
+        }
+        m_rearCache = m_rear.load(std::memory_order_acquire);
+        return m_rearCache - front;
+    }
+
+    size_t   m_size = 0;
+    size_t   m_mask = 0;
+    uint8_t* m_data = nullptr;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> m_front;
+    uint64_t m_rearCache;
+    uint64_t m_peekSize = 0;
+    alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> m_rear;
+    uint64_t m_frontCache;
+};
+
+// 跨进程的一读一写环：头部、索引和数据都放在shm_open创建的命名共享内存里
+// 生产者进程create，消费者进程attach；头部带布局版本与容量，attach时校验；
+// 双方各持有头部里的一把进程间robust mutex直到析构，进程死亡时由内核释放并标记，
+// peerState()据此发现对端退出或异常死亡(对端是尚未回收的僵尸进程时同样能发现)；
+// 构造和析构需在同一线程，持锁的线程退出也会被当作对端死亡
+const uint32_t SHM_RING_MAGIC     = 0x46554252; // "RBUF"
+const uint32_t SHM_RING_VERSION   = 2;
+const int      SHM_ATTACH_WAIT_MS = 1000; // attach时等待生产者完成ftruncate与头部初始化的上限
+
+template <class T> class ShmRingBuffer {
+    static_assert(std::is_trivially_copyable<T>::value, "shared memory element must be trivially copyable");
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "shared memory atomics must be lock free");
+
+public:
+    enum PeerState {
+        PEER_WAITING, // 对端尚未attach
+        PEER_ALIVE,
+        PEER_CLOSED,  // 对端正常退出
+        PEER_DEAD,    // 对端进程已不存在
+    };
+
+    // create == true: 生产者，创建并初始化，同名段已存在时失败(可能有别的生产者在用)；
+    // removeStale == true时先删掉同名的残留段再创建，仅在确定没有其他进程使用该名字时打开
+    // create == false: 消费者，attach到已有的段，生产者尚未初始化完时最多等待SHM_ATTACH_WAIT_MS
+    ShmRingBuffer(const char* name, unsigned size, bool create, bool removeStale = false)
+        : m_name(name), m_producer(create)
+    {
+        int fd = -1;
+        if (create) {
+            if (removeStale) {
+                shm_unlink(name);
+            }
+            fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (fd < 0) {
+                if (errno == EEXIST) {
+                    printf("shm %s: already exists\n", name);
+                } else {
+                    perror("shm_open create");
+                }
+                return;
+            }
+            unsigned int capacity = roundUpPow2(size);
+            m_mapSize             = sizeof(Header) + sizeof(T) * capacity;
+            if (ftruncate(fd, m_mapSize) != 0) {
+                perror("ftruncate");
+                close(fd);
+                shm_unlink(name);
+                return;
+            }
+        } else {
+            fd = shm_open(name, O_RDWR, 0);
+            if (fd < 0) {
+                perror("shm_open attach");
+                return;
+            }
+            // 生产者O_CREAT之后、ftruncate之前段长度为0，等它设好大小
+            auto        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHM_ATTACH_WAIT_MS);
+            struct stat st;
+            while (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) < sizeof(Header) &&
+                   std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if (static_cast<size_t>(st.st_size) < sizeof(Header)) {
+                printf("shm %s: segment too small\n", name);
+                close(fd);
+                return;
+            }
+            m_mapSize = st.st_size;
+        }
+        void* addr = mmap(nullptr, m_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED) {
+            perror("mmap shm");
+            return;
+        }
+        m_header = static_cast<Header*>(addr);
+        m_data   = reinterpret_cast<T*>(m_header + 1);
+
+        if (create) {
+            new (m_header) Header();
+            m_header->capacity    = roundUpPow2(size);
+            m_header->elemSize    = sizeof(T);
+            m_header->version     = SHM_RING_VERSION;
+            pthread_mutexattr_t attr;
+            pthread_mutexattr_init(&attr);
+            pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+            pthread_mutex_init(&m_header->producerAlive, &attr);
+            pthread_mutex_init(&m_header->consumerAlive, &attr);
+            pthread_mutexattr_destroy(&attr);
+            pthread_mutex_lock(&m_header->producerAlive);
+            m_header->producerPid = getpid();
+            // magic最后写，attach方看到magic即说明头部已初始化完
+            m_header->magic.store(SHM_RING_MAGIC, std::memory_order_release);
+        } else {
+            // magic为0说明生产者还没写完头部，不是布局不符，限时等待
+            auto     deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHM_ATTACH_WAIT_MS);
+            uint32_t magic    = 0;
+            while ((magic = m_header->magic.load(std::memory_order_acquire)) == 0 &&
+                   std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            if (magic == 0) {
+                printf("shm %s: not initialized by producer\n", name);
+                munmap(m_header, m_mapSize);
+                m_header = nullptr;
+                return;
+            }
+            if (magic != SHM_RING_MAGIC || m_header->version != SHM_RING_VERSION || m_header->elemSize != sizeof(T) ||
+                sizeof(Header) + sizeof(T) * m_header->capacity > m_mapSize) {
+                printf("shm %s: layout mismatch\n", name);
+                munmap(m_header, m_mapSize);
+                m_header = nullptr;
+                return;
+            }
+            // 上一个消费者异常退出留下的锁在这里接管；锁被占用说明已有活着的消费者
+            int ret = pthread_mutex_trylock(&m_header->consumerAlive);
+            if (ret == EOWNERDEAD) {
+                pthread_mutex_consistent(&m_header->consumerAlive);
+            } else if (ret != 0) {
+                printf("shm %s: already has a consumer\n", name);
+                munmap(m_header, m_mapSize);
+                m_header = nullptr;
+                return;
+            }
+            m_header->consumerPid = getpid();
+        }
+        m_size = m_header->capacity;
+        m_mask = m_size - 1;
+    }
 
-        value   = m_data[m_front];
-        m_front = (m_front + 1) % m_size;
+    ~ShmRingBuffer()
+    {
+        if (m_header == nullptr) {
+            return;
+        }
+        (m_producer ? m_header->producerClosed : m_header->consumerClosed).store(1, std::memory_order_release);
+        pthread_mutex_unlock(m_producer ? &m_header->producerAlive : &m_header->consumerAlive);
+        munmap(m_header, m_mapSize);
+        m_header = nullptr;
+        if (m_producer) {
+            // 已attach的消费者映射仍然有效，unlink只移除名字
+            shm_unlink(m_name.c_str());
+        }
+    }
+
+    ShmRingBuffer(const ShmRingBuffer&)            = delete;
+    ShmRingBuffer& operator=(const ShmRingBuffer&) = delete;
+
+    inline bool valid() const { return m_header != nullptr; }
+
+    // 仅生产者进程调用
+    bool push(const T& val)
+    {
+        unsigned int rear = m_header->rear.load(std::memory_order_relaxed);
+        if (rear - m_frontCache == m_size) {
+            m_frontCache = m_header->front.load(std::memory_order_acquire);
+            if (rear - m_frontCache == m_size) {
+                return false;
+            }
+        }
+        m_data[rear & m_mask] = val;
+        m_header->rear.store(rear + 1, std::memory_order_release);
         return true;
     }
 
-    inline unsigned int front() const { return m_front; }
+    // 仅消费者进程调用
+    bool pop(T& value)
+    {
+        unsigned int front = m_header->front.load(std::memory_order_relaxed);
+        if (front == m_rearCache) {
+            m_rearCache = m_header->rear.load(std::memory_order_acquire);
+            if (front == m_rearCache) {
+                return false;
+            }
+        }
+        value = m_data[front & m_mask];
+        m_header->front.store(front + 1, std::memory_order_release);
+        return true;
+    }
 
-    inline unsigned int rear() const { return m_rear; }
+    // 试探对端的存活锁：拿不到说明对端还持有；EOWNERDEAD说明持有者死了没解锁，结果记下来，之后不再试探
+    // 只作为长时间满/空时的兜底检查
+    PeerState peerState() const
+    {
+        if (m_peerDead) {
+            return PEER_DEAD;
+        }
+        const std::atomic<uint32_t>& closed = m_producer ? m_header->consumerClosed : m_header->producerClosed;
+        pthread_mutex_t*             alive  = m_producer ? &m_header->consumerAlive : &m_header->producerAlive;
+        pid_t pid = m_producer ? m_header->consumerPid.load() : m_header->producerPid.load();
+        int   ret = pthread_mutex_trylock(alive);
+        if (ret == EBUSY) {
+            return PEER_ALIVE;
+        }
+        if (ret == EOWNERDEAD) {
+            pthread_mutex_consistent(alive);
+            pthread_mutex_unlock(alive);
+            m_peerDead = true;
+            return PEER_DEAD;
+        }
+        if (ret == 0) {
+            pthread_mutex_unlock(alive);
+        }
+        // 对端先加锁再登记pid、先置closed再解锁，锁空闲时只可能是还没attach或已正常关闭
+        if (closed.load(std::memory_order_acquire) != 0) {
+            return PEER_CLOSED;
+        }
+        return pid == 0 ? PEER_WAITING : PEER_DEAD;
+    }
 
     inline unsigned int size() const { return m_size; }
 
 private:
-    unsigned int m_size;
-    int          m_front;
-    int          m_rear;
-    T*           m_data;
+    struct Header {
+        std::atomic<uint32_t> magic{0};
+        uint32_t              version  = 0;
+        uint32_t              capacity = 0;
+        uint32_t              elemSize = 0;
+        std::atomic<int32_t>  producerPid{0};
+        std::atomic<int32_t>  consumerPid{0};
+        std::atomic<uint32_t> producerClosed{0};
+        std::atomic<uint32_t> consumerClosed{0};
+        pthread_mutex_t       producerAlive; // 各自构造时加锁、析构时解锁
+        pthread_mutex_t       consumerAlive;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> front{0};
+        alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> rear{0};
+    };
+
+    std::string  m_name;
+    bool         m_producer;
+    size_t       m_mapSize    = 0;
+    Header*      m_header     = nullptr;
+    T*           m_data       = nullptr;
+    unsigned int m_size       = 0;
+    unsigned int m_mask       = 0;
+    unsigned int m_frontCache = 0; // 生产者进程本地
+    unsigned int m_rearCache  = 0; // 消费者进程本地
+    mutable bool m_peerDead   = false; // 见过对端死亡后不再试探
 };
 
 class Test {
@@ -62,11 +816,10 @@ public:
     {
 
         // printf("+++++++\n");
-        this->id    = id;
-        this->value = value;
-        data        = new char[128];
-        sprintf(data, "id = %d, value = %d\n", this->id, this->value);
+        data = new char[128];
+        set(id, value);
     }
+    Test(const Test&) = delete;
     ~Test()
     {
         // printf("------\n");
@@ -76,19 +829,28 @@ public:
         }
     }
     void     display() { printf("%s", data); }
+    // 复用已有缓冲区原地重填，配合reserve()/commit()不再分配
+    void set(int id, int value)
+    {
+        this->id    = id;
+        this->value = value;
+        snprintf(data, 128, "id = %d, value = %d\n", this->id, this->value);
+    }
     Test& operator=(Test&& rhs)
     {
         // printf("=======\n");
+        // 交换缓冲区而不是置空，被移走的槽位仍可直接复用，不再分配也不泄漏
+        this->stamp = rhs.stamp;
         this->id    = rhs.id;
         this->value = rhs.value;
-        this->data  = rhs.data;
-        rhs.data = nullptr;
+        std::swap(this->data, rhs.data);
         return *this;
     }
 
     Test& operator=(const Test& rhs)
     {
         // printf("=======\n");
+        this->stamp = rhs.stamp;
         this->id    = rhs.id;
         this->value = rhs.value;
         strcpy(this->data, rhs.data);
@@ -103,6 +865,8 @@ public:
     //     t.data = nullptr;
     // }
 
+    uint64_t stamp = 0; // 入队时刻，用于统计交接延时
+
 private:
     int   id;
     int   value;
@@ -115,53 +879,523 @@ double getDeltaTimeofDay(struct timeval* begin, struct timeval* end)
     return (end->tv_sec + end->tv_usec * 1.0 / 1000000) - (begin->tv_sec + begin->tv_usec * 1.0 / 1000000);
 }
 
-RingBuffer<Test> queue(1 << 12);
-#define N (10 * (1 << 20))
-void produce()
+// 不同负载大小的定长消息，拷贝即memcpy
+template <unsigned int Size> struct Payload {
+    Payload(int id = 0, int value = 0) { set(id, value); }
+    void set(int id, int value)
+    {
+        data[0]        = static_cast<char>(id);
+        data[Size - 1] = static_cast<char>(value);
+    }
+    uint64_t stamp = 0;
+    char     data[Size];
+};
+
+inline uint64_t nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+uint64_t percentile(std::vector<uint64_t>& samples, double p)
+{
+    if (samples.empty()) {
+        return 0;
+    }
+    size_t idx = static_cast<size_t>(p * (samples.size() - 1));
+    std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+    return samples[idx];
+}
+
+#define N (1 << 20)
+template <class Queue, class Msg> void produce(Queue* queue, unsigned int count, double* elapsed)
 {
     struct timeval begin, end;
     gettimeofday(&begin, nullptr);
     unsigned int i = 0;
     // printf("[][][][][]\n");
-    while (i < N) {
-        Test test(i % 1024, i);
-        if (queue.push(test)) {
+    while (i < count) {
+        Msg msg(i % 1024, i);
+        msg.stamp = nowNs();
+        if (queue->push(msg)) {
             ++i;
         }
-        // if (queue.push(Test(i % 1024, i))) {
-        //     ++i;
-        // }
     }
     gettimeofday(&end, nullptr);
-    double tm = getDeltaTimeofDay(&begin, &end);
-    printf("producer tid = %lu, %lf MB/s, %f msg/sm elapsed = %f size = %u\n", std::this_thread::get_id(),
-           N * (sizeof(Test) + 128) * 1.0 / (tm * 1024 * 1024), N * 1.0 / tm, tm, i);
+    *elapsed = getDeltaTimeofDay(&begin, &end);
 }
 
-void consume()
+template <class Queue, class Msg> void consume(Queue* queue, unsigned int count, uint64_t* latency, double* elapsed)
 {
-    sleep(1);
-    Test           test;
+    Msg            msg;
     struct timeval begin, end;
     gettimeofday(&begin, nullptr);
     unsigned int i = 0;
-    while (i < N) {
-        if (queue.pop(test)) {
-            // test.display();
+    while (i < count) {
+        if (queue->pop(msg)) {
+            // msg.display();
+            latency[i] = nowNs() - msg.stamp;
             ++i;
         }
     }
     gettimeofday(&end, nullptr);
-    double tm = getDeltaTimeofDay(&begin, &end);
-    printf("consumer tid = %lu, %lf MB/s, %f msg/sm elapsed = %f size = %u\n", std::this_thread::get_id(),
-           N * (sizeof(Test) + 128) * 1.0 / (tm * 1024 * 1024), N * 1.0 / tm, tm, i);
+    *elapsed = getDeltaTimeofDay(&begin, &end);
+}
+
+template <class Msg, bool CachedIndex> void runSpsc(const char* name, unsigned int capacity, unsigned int count)
+{
+    using Queue = RingBuffer<Msg, CachedIndex>;
+    Queue                 queue(capacity);
+    std::vector<uint64_t> latency(count);
+    double                prodTm = 0;
+    double                consTm = 0;
+    std::thread           prod(produce<Queue, Msg>, &queue, count, &prodTm);
+    std::thread           cons(consume<Queue, Msg>, &queue, count, latency.data(), &consTm);
+    prod.join();
+    cons.join();
+    double tm = std::max(prodTm, consTm);
+    printf("%-8s %-12s %8u %8zu %14.0f %10lu %10lu\n", CachedIndex ? "cached" : "atomic", name, queue.size(),
+           sizeof(Msg), count / tm, percentile(latency, 0.5), percentile(latency, 0.99));
+}
+
+template <class Msg> void runSpscMatrix(const char* name, unsigned int count)
+{
+    const unsigned int capacities[] = {1 << 6, 1 << 10, 1 << 14};
+    for (auto capacity : capacities) {
+        // 老路径：每次判空判满都读对端索引；新路径：缓存对端索引
+        runSpsc<Msg, false>(name, capacity, count);
+        runSpsc<Msg, true>(name, capacity, count);
+    }
+}
+
+template <class Queue, class Msg>
+void produceBatch(Queue* queue, unsigned int count, unsigned int batch, double* elapsed)
+{
+    std::vector<Msg> msgs(batch);
+    struct timeval   begin, end;
+    gettimeofday(&begin, nullptr);
+    unsigned int i = 0;
+    while (i < count) {
+        unsigned int n = std::min(batch, count - i);
+        for (unsigned int k = 0; k < n; ++k) {
+            msgs[k]       = Msg((i + k) % 1024, i + k);
+            msgs[k].stamp = nowNs();
+        }
+        unsigned int pushed = 0;
+        while (pushed < n) {
+            pushed += queue->push_n(msgs.data() + pushed, n - pushed);
+        }
+        i += n;
+    }
+    gettimeofday(&end, nullptr);
+    *elapsed = getDeltaTimeofDay(&begin, &end);
+}
+
+template <class Queue, class Msg>
+void consumeBatch(Queue* queue, unsigned int count, unsigned int batch, uint64_t* latency, double* elapsed)
+{
+    std::vector<Msg> msgs(batch);
+    struct timeval   begin, end;
+    gettimeofday(&begin, nullptr);
+    unsigned int i = 0;
+    while (i < count) {
+        unsigned int n   = queue->pop_n(msgs.data(), std::min(batch, count - i));
+        uint64_t     now = nowNs();
+        for (unsigned int k = 0; k < n; ++k) {
+            latency[i + k] = now - msgs[k].stamp;
+        }
+        i += n;
+    }
+    gettimeofday(&end, nullptr);
+    *elapsed = getDeltaTimeofDay(&begin, &end);
+}
+
+template <class Msg> void runBatch(const char* name, unsigned int batch, unsigned int count)
+{
+    using Queue = RingBuffer<Msg>;
+    Queue                 queue(1 << 12);
+    std::vector<uint64_t> latency(count);
+    double                prodTm = 0;
+    double                consTm = 0;
+    std::thread           prod(produceBatch<Queue, Msg>, &queue, count, batch, &prodTm);
+    std::thread           cons(consumeBatch<Queue, Msg>, &queue, count, batch, latency.data(), &consTm);
+    prod.join();
+    cons.join();
+    double tm = std::max(prodTm, consTm);
+    printf("%-12s %6u %8u %14.0f %10lu %10lu\n", name, batch, queue.size(), count / tm, percentile(latency, 0.5),
+           percentile(latency, 0.99));
+}
+
+void runBatchBench(unsigned int count)
+{
+    const unsigned int batches[] = {1, 8, 64, 512};
+    printf("%-12s %6s %8s %14s %10s %10s\n", "payload", "batch", "capacity", "msg/s", "p50(ns)", "p99(ns)");
+    for (auto batch : batches) {
+        runBatch<Payload<16>>("payload16", batch, count);
+    }
+    for (auto batch : batches) {
+        runBatch<Payload<128>>("payload128", batch, count);
+    }
+    for (auto batch : batches) {
+        runBatch<Test>("Test(heap)", batch, count);
+    }
+}
+
+template <class Queue, class Msg> void produceInPlace(Queue* queue, unsigned int count, double* elapsed)
+{
+    struct timeval begin, end;
+    gettimeofday(&begin, nullptr);
+    unsigned int i = 0;
+    while (i < count) {
+        Msg* slot = queue->reserve();
+        if (slot == nullptr) {
+            continue;
+        }
+        slot->set(i % 1024, i);
+        slot->stamp = nowNs();
+        queue->commit();
+        ++i;
+    }
+    gettimeofday(&end, nullptr);
+    *elapsed = getDeltaTimeofDay(&begin, &end);
 }
 
-int main()
+template <class Queue, class Msg>
+void consumeInPlace(Queue* queue, unsigned int count, uint64_t* latency, double* elapsed)
 {
-    std::thread prod(produce);
-    std::thread cons(consume);
+    struct timeval begin, end;
+    gettimeofday(&begin, nullptr);
+    unsigned int i = 0;
+    while (i < count) {
+        Msg* slot = queue->peek();
+        if (slot == nullptr) {
+            continue;
+        }
+        // slot->display();
+        latency[i] = nowNs() - slot->stamp;
+        queue->release();
+        ++i;
+    }
+    gettimeofday(&end, nullptr);
+    *elapsed = getDeltaTimeofDay(&begin, &end);
+}
+
+template <class Msg, bool InPlace> void runZeroCopy(const char* name, unsigned int capacity, unsigned int count)
+{
+    using Queue = RingBuffer<Msg>;
+    Queue                 queue(capacity);
+    std::vector<uint64_t> latency(count);
+    double                prodTm = 0;
+    double                consTm = 0;
+    uint64_t              allocs = allocCount.load();
+    std::thread           prod, cons;
+    if (InPlace) {
+        prod = std::thread(produceInPlace<Queue, Msg>, &queue, count, &prodTm);
+        cons = std::thread(consumeInPlace<Queue, Msg>, &queue, count, latency.data(), &consTm);
+    } else {
+        prod = std::thread(produce<Queue, Msg>, &queue, count, &prodTm);
+        cons = std::thread(consume<Queue, Msg>, &queue, count, latency.data(), &consTm);
+    }
     prod.join();
     cons.join();
+    allocs     = allocCount.load() - allocs;
+    double tm  = std::max(prodTm, consTm);
+    printf("%-8s %-12s %8u %14.0f %10lu %10lu %10.3f\n", InPlace ? "inplace" : "copy", name, queue.size(), count / tm,
+           percentile(latency, 0.5), percentile(latency, 0.99), allocs * 1.0 / count);
+}
+
+void runZeroCopyBench(unsigned int count)
+{
+    printf("%-8s %-12s %8s %14s %10s %10s %10s\n", "path", "payload", "capacity", "msg/s", "p50(ns)", "p99(ns)",
+           "allocs/msg");
+    runZeroCopy<Test, false>("Test(heap)", 1 << 12, count);
+    runZeroCopy<Test, true>("Test(heap)", 1 << 12, count);
+    runZeroCopy<Payload<1024>, false>("payload1024", 1 << 12, count);
+    runZeroCopy<Payload<1024>, true>("payload1024", 1 << 12, count);
+    // 近似一帧1080p H.264 I帧的大小
+    runZeroCopy<Payload<1 << 18>, false>("frame256K", 1 << 4, count / 64);
+    runZeroCopy<Payload<1 << 18>, true>("frame256K", 1 << 4, count / 64);
+}
+
+// 模拟变长的NAL/PCM块：长度在[1, 64K]间变化，内容为序号的低8位，消费者原地校验
+void runBytesBench(unsigned int count)
+{
+    ByteRingBuffer ring(1 << 20);
+    if (!ring.valid()) {
+        return;
+    }
+    uint64_t    bytes   = 0;
+    uint64_t    wrapped = 0;
+    double      prodTm  = 0;
+    double      consTm  = 0;
+    std::thread prod([&]() {
+        struct timeval begin, end;
+        gettimeofday(&begin, nullptr);
+        for (unsigned int i = 0; i < count; ++i) {
+            uint32_t len = (i * 2654435761u) % (1 << 16) + 1;
+            uint8_t* ptr = nullptr;
+            while ((ptr = ring.reserve(len)) == nullptr) {
+            }
+            memset(ptr, static_cast<uint8_t>(i), len);
+            ring.commit(len);
+        }
+        gettimeofday(&end, nullptr);
+        prodTm = getDeltaTimeofDay(&begin, &end);
+    });
+    std::thread cons([&]() {
+        struct timeval begin, end;
+        gettimeofday(&begin, nullptr);
+        for (unsigned int i = 0; i < count; ++i) {
+            uint32_t       len = 0;
+            const uint8_t* ptr = nullptr;
+            while ((ptr = ring.peek(&len)) == nullptr) {
+            }
+            uint8_t tag = static_cast<uint8_t>(i);
+            if (ptr[0] != tag || ptr[len / 2] != tag || ptr[len - 1] != tag) {
+                printf("record %u corrupted\n", i);
+            }
+            size_t offset = (ptr - ring.data()) & (ring.size() - 1);
+            if (offset + len > ring.size()) {
+                ++wrapped;
+            }
+            bytes += len;
+            ring.release();
+        }
+        gettimeofday(&end, nullptr);
+        consTm = getDeltaTimeofDay(&begin, &end);
+    });
+    prod.join();
+    cons.join();
+    double tm = std::max(prodTm, consTm);
+    printf("records = %u, %f records/s, %lf MB/s, wrapped records read in place = %lu\n", count, count / tm,
+           bytes / (tm * 1024 * 1024), wrapped);
+}
+
+// 生产者每隔interval发一条带时间戳的消息，消费者用pop_wait阻塞接收：
+// 唤醒延时 = 收到时刻 - 发送时刻，空闲开销 = 消费者线程cpu时间 / 墙上时间
+template <class Wait> void runWait(const char* name, unsigned int count, std::chrono::microseconds interval)
+{
+    using Queue = RingBuffer<Payload<16>, true, Wait>;
+    Queue                 queue(1 << 10);
+    std::vector<uint64_t> latency(count);
+    double                cpuUsage = 0;
+    std::thread           cons([&]() {
+        struct timespec cpuBegin, cpuEnd;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuBegin);
+        uint64_t    begin = nowNs();
+        Payload<16> msg;
+        for (unsigned int i = 0; i < count; ++i) {
+            queue.pop_wait(msg);
+            latency[i] = nowNs() - msg.stamp;
+        }
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+        double cpu = (cpuEnd.tv_sec - cpuBegin.tv_sec) + (cpuEnd.tv_nsec - cpuBegin.tv_nsec) * 1.0 / 1000000000;
+        cpuUsage   = cpu * 1000000000 / (nowNs() - begin);
+    });
+    for (unsigned int i = 0; i < count; ++i) {
+        std::this_thread::sleep_for(interval);
+        Payload<16> msg(i % 1024, i);
+        msg.stamp = nowNs();
+        queue.push_wait(msg);
+    }
+    cons.join();
+    printf("%-8s %8lu %10lu %10lu %9.1f%%\n", name, static_cast<unsigned long>(interval.count()),
+           percentile(latency, 0.5), percentile(latency, 0.99), cpuUsage * 100);
+}
+
+void runWaitBench(unsigned int count)
+{
+    const std::chrono::microseconds intervals[] = {std::chrono::microseconds(100), std::chrono::microseconds(1000)};
+    printf("%-8s %8s %10s %10s %10s\n", "wait", "gap(us)", "p50(ns)", "p99(ns)", "cons cpu");
+    for (auto interval : intervals) {
+        runWait<BusySpinWait>("spin", count, interval);
+        runWait<YieldWait>("yield", count, interval);
+        runWait<ParkWait>("park", count, interval);
+    }
+}
+
+// 与split_mp4输出的out.h264/out.pcm相同的用法：按块搬运一个文件，len == 0表示结束
+struct Chunk {
+    uint32_t len;
+    uint8_t  data[4096];
+};
+
+uint64_t checksum(uint64_t sum, const uint8_t* data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; ++i) {
+        sum = sum * 131 + data[i];
+    }
+    return sum;
+}
+
+// 子进程里的消费者，返回值作为退出码；ShmRingBuffer在返回前析构，对端能看到正常关闭
+int runShmConsumer(const char* name)
+{
+    ShmRingBuffer<Chunk> consumer(name, 0, false);
+    if (!consumer.valid()) {
+        return 1;
+    }
+    Chunk    chunk;
+    uint64_t sum   = 0;
+    uint64_t bytes = 0;
+    while (true) {
+        if (!consumer.pop(chunk)) {
+            if (consumer.peerState() == ShmRingBuffer<Chunk>::PEER_DEAD) {
+                printf("consumer: producer died\n");
+                return 1;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        if (chunk.len == 0) {
+            break;
+        }
+        sum = checksum(sum, chunk.data, chunk.len);
+        bytes += chunk.len;
+    }
+    printf("consumer pid = %d, bytes = %lu, checksum = %016lx\n", getpid(), bytes, sum);
     return 0;
-}
\ No newline at end of file
+}
+
+// fork出消费者进程，父进程作为生产者把文件经共享内存传过去，双方各自打印校验和
+int runShmBench(const char* path)
+{
+    const char* name = "/ringbuffer_demo";
+    FILE*       in   = fopen(path, "rb");
+    if (in == nullptr) {
+        perror(path);
+        return -1;
+    }
+    // 固定名字只给本demo用，上次异常退出留下的同名段可以直接删掉
+    ShmRingBuffer<Chunk> producer(name, 1 << 8, true, true);
+    if (!producer.valid()) {
+        fclose(in);
+        return -1;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        fclose(in);
+        int ret = runShmConsumer(name);
+        fflush(stdout);
+        // 不走exit：继承来的producer等对象不能在子进程里析构
+        _exit(ret);
+    }
+
+    struct timeval begin, end;
+    gettimeofday(&begin, nullptr);
+    Chunk    chunk;
+    uint64_t sum   = 0;
+    uint64_t bytes = 0;
+    bool     eof    = false;
+    int      status = 0;
+    bool     reaped = false;
+    while (!eof) {
+        chunk.len = fread(chunk.data, 1, sizeof(chunk.data), in);
+        eof       = chunk.len == 0;
+        sum       = checksum(sum, chunk.data, chunk.len);
+        bytes += chunk.len;
+        while (!producer.push(chunk)) {
+            // 子进程还没attach就退出时对端一直是PEER_WAITING，直接看子进程有没有退出
+            reaped     = waitpid(pid, &status, WNOHANG) == pid;
+            auto state = producer.peerState();
+            if (reaped || state == ShmRingBuffer<Chunk>::PEER_DEAD || state == ShmRingBuffer<Chunk>::PEER_CLOSED) {
+                printf("producer: consumer gone\n");
+                fclose(in);
+                if (!reaped) {
+                    waitpid(pid, nullptr, 0);
+                }
+                return -1;
+            }
+            std::this_thread::yield();
+        }
+    }
+    fclose(in);
+    if (!reaped) {
+        waitpid(pid, &status, 0);
+    }
+    gettimeofday(&end, nullptr);
+    double tm = getDeltaTimeofDay(&begin, &end);
+    printf("producer pid = %d, bytes = %lu, checksum = %016lx, %lf MB/s\n", getpid(), bytes, sum,
+           bytes / (tm * 1024 * 1024));
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+void runSpscBench(unsigned int count)
+{
+    printf("%-8s %-12s %8s %8s %14s %10s %10s\n", "index", "payload", "capacity", "bytes", "msg/s", "p50(ns)",
+           "p99(ns)");
+    runSpscMatrix<Payload<16>>("payload16", count);
+    runSpscMatrix<Payload<128>>("payload128", count);
+    runSpscMatrix<Payload<1024>>("payload1024", count);
+    runSpscMatrix<Test>("Test(heap)", count);
+}
+
+// producers个生产者各写count / producers条，consumers个消费者平分读完
+template <class Queue, class Msg>
+void runMpmc(const char* name, unsigned int producers, unsigned int consumers, unsigned int capacity,
+             unsigned int count)
+{
+    Queue                    queue(capacity);
+    unsigned int             perProducer = count / producers;
+    unsigned int             total       = perProducer * producers;
+    std::vector<uint64_t>    latency(total);
+    std::vector<double>      elapsed(producers + consumers);
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < producers; ++i) {
+        threads.emplace_back(produce<Queue, Msg>, &queue, perProducer, &elapsed[i]);
+    }
+    unsigned int offset = 0;
+    for (unsigned int i = 0; i < consumers; ++i) {
+        unsigned int share = i + 1 == consumers ? total - offset : total / consumers;
+        threads.emplace_back(consume<Queue, Msg>, &queue, share, latency.data() + offset, &elapsed[producers + i]);
+        offset += share;
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    double tm = *std::max_element(elapsed.begin(), elapsed.end());
+    printf("%-8s %4u %4u %8u %14.0f %10lu %10lu\n", name, producers, consumers, queue.size(), total / tm,
+           percentile(latency, 0.5), percentile(latency, 0.99));
+}
+
+void runMpmcBench(unsigned int count)
+{
+    using Msg                      = Payload<128>;
+    const unsigned int threadNum[] = {1, 2, 4, 8};
+    printf("%-8s %4s %4s %8s %14s %10s %10s\n", "queue", "prod", "cons", "capacity", "msg/s", "p50(ns)", "p99(ns)");
+    for (auto producers : threadNum) {
+        for (auto consumers : threadNum) {
+            runMpmc<MpmcRingBuffer<Msg>, Msg>("mpmc", producers, consumers, 1 << 12, count);
+            runMpmc<MutexQueue<Msg>, Msg>("mutex", producers, consumers, 1 << 12, count);
+        }
+    }
+}
+
+// ./ringbuffer [spsc|mpmc|batch|zerocopy|bytes|wait] [count]
+// ./ringbuffer shm [file]
+int main(int argc, char* argv[])
+{
+    const char*  mode  = argc > 1 ? argv[1] : "spsc";
+    unsigned int count = argc > 2 ? atoi(argv[2]) : N;
+    if (strcmp(mode, "spsc") == 0) {
+        runSpscBench(count);
+    } else if (strcmp(mode, "mpmc") == 0) {
+        runMpmcBench(count);
+    } else if (strcmp(mode, "batch") == 0) {
+        runBatchBench(count);
+    } else if (strcmp(mode, "zerocopy") == 0) {
+        runZeroCopyBench(count);
+    } else if (strcmp(mode, "bytes") == 0) {
+        runBytesBench(count);
+    } else if (strcmp(mode, "wait") == 0) {
+        runWaitBench(count);
+    } else if (strcmp(mode, "shm") == 0) {
+        return runShmBench(argc > 2 ? argv[2] : "luca.aac");
+    } else {
+        printf("usage: %s [spsc|mpmc|batch|zerocopy|bytes|wait] [count]\n", argv[0]);
+        printf("       %s shm [file]\n", argv[0]);
+        return -1;
+    }
+    return 0;
+}
@@ -1,24 +1,361 @@
+#include "bench_util.h"
+#include "lock_profiler.h"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <linux/futex.h>
 #include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <shared_mutex>
+#include <string>
+#include <sys/syscall.h>
 #include <thread>
-class SpinLock {
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+const unsigned int SPIN_MAX_BACKOFF = 1 << 10;
+const unsigned int SPIN_PARK_BUDGET = 1 << 7;
+const unsigned int CACHE_LINE_SIZE  = 64;
+const unsigned int MCS_MAX_NESTING  = 8;
+const unsigned int RW_READER_SLOTS  = 64;
+
+// 最初的实现：对同一个cache line不停地test_and_set，作为对比基线保留
+class TasSpinLock {
     std::atomic_flag flag = ATOMIC_FLAG_INIT;
 
+public:
+    TasSpinLock()                              = default;
+    TasSpinLock(const TasSpinLock&)            = delete;
+    TasSpinLock& operator=(const TasSpinLock&) = delete;
+    void         lock()
+    {
+        while (flag.test_and_set(std::memory_order_acquire)) {
+        }
+    }
+    bool try_lock() { return !flag.test_and_set(std::memory_order_acquire); }
+    void unlock() { flag.clear(std::memory_order_release); }
+};
+
+// test-and-test-and-set：锁被占用时只读等待(cache line保持共享态)，失败后pause + 指数退避
+class SpinLock {
+    std::atomic<bool> flag{false};
+
 public:
     SpinLock()                           = default;
     SpinLock(const SpinLock&)            = delete;
     SpinLock& operator=(const SpinLock&) = delete;
-    void      lock()
+    void      lock() { lock_spins(); }
+
+    // 返回退避的轮数，ProfiledLock据此统计自旋次数
+    unsigned int lock_spins()
     {
-        bool expected = false;
-        while (flag.test_and_set()) {
+        unsigned int backoff = 1;
+        unsigned int rounds  = 0;
+        while (flag.exchange(true, std::memory_order_acquire)) {
+            while (flag.load(std::memory_order_relaxed)) {
+                for (unsigned int i = 0; i < backoff; ++i) {
+                    cpuRelax();
+                }
+                backoff = std::min(backoff * 2, SPIN_MAX_BACKOFF);
+                ++rounds;
+            }
         }
+        return rounds;
     }
-    void unlock() { flag.clear(); }
+    bool try_lock() { return !flag.load(std::memory_order_relaxed) && !flag.exchange(true, std::memory_order_acquire); }
+    void unlock() { flag.store(false, std::memory_order_release); }
 };
 
+// 自适应：先按SpinLock的方式自旋退避，超过SPIN_PARK_BUDGET轮仍未拿到则在futex上睡眠
+// state: 0 未加锁，1 已加锁无人等待，2 已加锁且可能有人睡眠(解锁时需要唤醒)
+class AdaptiveSpinLock {
+    std::atomic<int> state{0};
 
+public:
+    AdaptiveSpinLock()                                   = default;
+    AdaptiveSpinLock(const AdaptiveSpinLock&)            = delete;
+    AdaptiveSpinLock& operator=(const AdaptiveSpinLock&) = delete;
+    void              lock() { lock_spins(); }
+
+    // 返回睡眠前退避的轮数，ProfiledLock据此统计自旋次数
+    unsigned int lock_spins()
+    {
+        unsigned int backoff = 1;
+        for (unsigned int spin = 0; spin < SPIN_PARK_BUDGET; ++spin) {
+            if (try_lock()) {
+                return spin;
+            }
+            for (unsigned int i = 0; i < backoff; ++i) {
+                cpuRelax();
+            }
+            backoff = std::min(backoff * 2, SPIN_MAX_BACKOFF);
+        }
+        while (state.exchange(2, std::memory_order_acquire) != 0) {
+            syscall(SYS_futex, reinterpret_cast<int*>(&state), FUTEX_WAIT_PRIVATE, 2, nullptr, nullptr, 0);
+        }
+        return SPIN_PARK_BUDGET;
+    }
+    bool try_lock()
+    {
+        int expected = 0;
+        return state.load(std::memory_order_relaxed) == 0 &&
+               state.compare_exchange_strong(expected, 1, std::memory_order_acquire);
+    }
+    void unlock()
+    {
+        if (state.exchange(0, std::memory_order_release) == 2) {
+            syscall(SYS_futex, reinterpret_cast<int*>(&state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+    }
+};
+
+// 排队取号：按到达顺序获得锁，公平；等待者按自己前面的人数做比例退避
+class TicketLock {
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned int> next{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned int> serving{0};
+
+public:
+    TicketLock()                             = default;
+    TicketLock(const TicketLock&)            = delete;
+    TicketLock& operator=(const TicketLock&) = delete;
+    void        lock()
+    {
+        unsigned int ticket = next.fetch_add(1, std::memory_order_relaxed);
+        while (true) {
+            unsigned int cur = serving.load(std::memory_order_acquire);
+            if (cur == ticket) {
+                return;
+            }
+            for (unsigned int i = 0; i < (ticket - cur) * 32; ++i) {
+                cpuRelax();
+            }
+        }
+    }
+    bool try_lock()
+    {
+        unsigned int cur = serving.load(std::memory_order_relaxed);
+        unsigned int expected = cur;
+        return next.compare_exchange_strong(expected, cur + 1, std::memory_order_acquire);
+    }
+    void unlock() { serving.store(serving.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+};
+
+// MCS队列锁：每个等待者只在自己节点(独占一个cache line)的locked上自旋，由前驱解锁时交接，FIFO公平
+// 为了保持lock()/unlock()接口，节点取自线程局部的节点池，持锁节点记录在owner里
+struct alignas(CACHE_LINE_SIZE) McsNode {
+    std::atomic<McsNode*> next{nullptr};
+    std::atomic<bool>     locked{false};
+    bool                  inUse = false; // 只由所属线程访问
+};
+
+class McsLock {
+    alignas(CACHE_LINE_SIZE) std::atomic<McsNode*> tail{nullptr};
+    McsNode* owner = nullptr; // 只由持锁线程读写
+
+    static McsNode* acquireNode()
+    {
+        thread_local McsNode nodes[MCS_MAX_NESTING];
+        for (auto& node : nodes) {
+            if (!node.inUse) {
+                node.inUse = true;
+                node.next.store(nullptr, std::memory_order_relaxed);
+                node.locked.store(true, std::memory_order_relaxed);
+                return &node;
+            }
+        }
+        std::cerr << "McsLock: more than " << MCS_MAX_NESTING << " locks held by one thread" << std::endl;
+        std::abort();
+    }
+
+public:
+    McsLock()                          = default;
+    McsLock(const McsLock&)            = delete;
+    McsLock& operator=(const McsLock&) = delete;
+    void     lock()
+    {
+        McsNode* node = acquireNode();
+        McsNode* prev = tail.exchange(node, std::memory_order_acq_rel);
+        if (prev != nullptr) {
+            prev->next.store(node, std::memory_order_release);
+            while (node->locked.load(std::memory_order_acquire)) {
+                cpuRelax();
+            }
+        }
+        owner = node;
+    }
+    bool try_lock()
+    {
+        McsNode* node     = acquireNode();
+        McsNode* expected = nullptr;
+        if (tail.compare_exchange_strong(expected, node, std::memory_order_acquire)) {
+            owner = node;
+            return true;
+        }
+        node->inUse = false;
+        return false;
+    }
+    void unlock()
+    {
+        McsNode* node = owner;
+        McsNode* succ = node->next.load(std::memory_order_acquire);
+        if (succ == nullptr) {
+            McsNode* expected = node;
+            if (tail.compare_exchange_strong(expected, nullptr, std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+                node->inUse = false;
+                return;
+            }
+            // 后继已经交换了tail但还没链上来
+            while ((succ = node->next.load(std::memory_order_acquire)) == nullptr) {
+                cpuRelax();
+            }
+        }
+        succ->locked.store(false, std::memory_order_release);
+        node->inUse = false;
+    }
+};
+
+// 顺序锁：适合写极少、读极多的小块数据(如sps/pps)
+// 读者不写任何共享变量，seq为奇数(正在写)或读前后seq不一致则重试；写者只能有一个，多个写者需要外部加锁
+// 数据按8字节拆成relaxed原子读写，读者与写者并发时不构成数据竞争
+template <class T> class SeqLock {
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock requires a trivially copyable type");
+    static const size_t WORDS = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    alignas(CACHE_LINE_SIZE) std::atomic<unsigned int> seq{0};
+    std::atomic<uint64_t> words[WORDS] = {};
+
+public:
+    SeqLock()                          = default;
+    SeqLock(const SeqLock&)            = delete;
+    SeqLock& operator=(const SeqLock&) = delete;
+
+    T load() const
+    {
+        uint64_t     buf[WORDS];
+        unsigned int begin, end;
+        do {
+            while ((begin = seq.load(std::memory_order_acquire)) & 1) {
+                cpuRelax();
+            }
+            for (size_t i = 0; i < WORDS; ++i) {
+                buf[i] = words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            end = seq.load(std::memory_order_relaxed);
+        } while (begin != end);
+        T val;
+        memcpy(&val, buf, sizeof(T));
+        return val;
+    }
+
+    void store(const T& val)
+    {
+        uint64_t buf[WORDS] = {};
+        memcpy(buf, &val, sizeof(T));
+        unsigned int cur = seq.load(std::memory_order_relaxed);
+        seq.store(cur + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; ++i) {
+            words[i].store(buf[i], std::memory_order_relaxed);
+        }
+        seq.store(cur + 2, std::memory_order_release);
+    }
+};
+
+// 读者偏向的读写自旋锁：读者计数按线程分散到RW_READER_SLOTS个独占cache line的槽里，读者之间不争同一条cache line
+// 写者置位writer后检查所有槽，仍有读者在读就撤回让路，等读者走空再试(写者可能饥饿，适合写极少的场景)
+class RWSpinLock {
+    struct alignas(CACHE_LINE_SIZE) Slot {
+        std::atomic<int> readers{0};
+    };
+
+    alignas(CACHE_LINE_SIZE) std::atomic<bool> writer{false};
+    Slot slots[RW_READER_SLOTS];
+
+    static Slot& slotOf(Slot* slots)
+    {
+        static std::atomic<unsigned int> nextSlot{0};
+        thread_local unsigned int        index = nextSlot.fetch_add(1, std::memory_order_relaxed) % RW_READER_SLOTS;
+        return slots[index];
+    }
+
+    bool noReaders() const
+    {
+        for (auto& slot : slots) {
+            if (slot.readers.load(std::memory_order_seq_cst) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    RWSpinLock()                             = default;
+    RWSpinLock(const RWSpinLock&)            = delete;
+    RWSpinLock& operator=(const RWSpinLock&) = delete;
+
+    void lock_shared()
+    {
+        while (!try_lock_shared()) {
+            while (writer.load(std::memory_order_relaxed)) {
+                cpuRelax();
+            }
+        }
+    }
+    bool try_lock_shared()
+    {
+        Slot& slot = slotOf(slots);
+        // 先登记再检查writer，与lock()中先置writer再检查槽位配对(都是seq_cst)
+        slot.readers.fetch_add(1, std::memory_order_seq_cst);
+        if (!writer.load(std::memory_order_seq_cst)) {
+            return true;
+        }
+        slot.readers.fetch_sub(1, std::memory_order_release);
+        return false;
+    }
+    void unlock_shared() { slotOf(slots).readers.fetch_sub(1, std::memory_order_release); }
+
+    void lock()
+    {
+        while (true) {
+            while (writer.exchange(true, std::memory_order_seq_cst)) {
+                while (writer.load(std::memory_order_relaxed)) {
+                    cpuRelax();
+                }
+            }
+            if (noReaders()) {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return;
+            }
+            writer.store(false, std::memory_order_release);
+            while (!noReaders()) {
+                cpuRelax();
+            }
+        }
+    }
+    bool try_lock()
+    {
+        if (writer.exchange(true, std::memory_order_seq_cst)) {
+            return false;
+        }
+        if (noReaders()) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return true;
+        }
+        writer.store(false, std::memory_order_release);
+        return false;
+    }
+    void unlock() { writer.store(false, std::memory_order_release); }
+};
 
 // class SpinLock {
 //     std::atomic_bool flag = ATOMIC_VAR_INIT(false);
@@ -37,40 +374,400 @@ public:
 //     }
 // };
 
-int      num = 0;
-SpinLock mutex;
-std::mutex mut;
+// 加锁基准测试：按 线程数 x 临界区长度 x 临界区外工作量 扫描每种锁，线程绑核；
+// 每个组合重复运行，直到ops/s的变异系数低于阈值(或达到最大次数)，结果输出为csv或json，便于跨版本比较
+struct SuiteConfig {
+    std::vector<int>         threads     = {1, 2, 4, 8, 16};
+    std::vector<int>         csWork      = {10, 200};  // 临界区内的工作量(空循环次数)
+    std::vector<int>         outsideWork = {0, 200};   // 两次加锁之间的工作量
+    std::vector<std::string> locks;                    // 为空表示全部
+    int                      durationMs  = 100;
+    int                      minRuns     = 3;
+    int                      maxRuns     = 20;
+    double                   cvTarget    = 0.05;
+    bool                     json        = false;
+    bool                     pin         = true;
+};
+
+struct RunResult {
+    double                opsPerSec = 0;
+    double                fairness  = 0; // 各线程完成次数 最少/最多
+    std::vector<uint32_t> waits;         // 每64次加锁采样一次等待时间
+};
+
+std::vector<int> g_cpus;
 
-void func1()
+inline void spinWork(int n)
 {
-    // mutex.lock();
-    std::lock_guard<SpinLock> lock(mutex);
-    // std::lock_guard<std::mutex> lock(mut);
-    num += 2;
-    std::cout << "func1: " << num << std::endl << std::flush;
-    // mutex.unlock();
+    for (int i = 0; i < n; ++i) {
+        asm volatile("" ::: "memory");
+    }
 }
 
-void func2()
+void pinThread(int index)
 {
-    // mutex.lock();
-    std::lock_guard<SpinLock> lock(mutex);
-    // std::lock_guard<std::mutex> lock(mut);
-    num -= 1;
-    std::cout << "func2: " << num << std::endl << std::flush;
-    // mutex.unlock();
+    if (g_cpus.empty()) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(g_cpus[index % g_cpus.size()], &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
 }
 
-int main()
+template <class Lock> RunResult runOnce(const SuiteConfig& config, int threadNum, int csWork, int outsideWork)
 {
-    std::thread t1(func1);
-    std::thread t2(func2);
-    t1.join();
-    t2.join();
-    // std::lock_guard<SpinLock> lock(mutex);
-    std::cout << "main: " << num << std::endl << std::flush;
-    // func1 和 func2 只会有两种情况
-    // -1， 1
-    // 2， 1
+    struct alignas(CACHE_LINE_SIZE) Shared {
+        uint64_t counter = 0;
+    };
+    Lock                               lock;
+    Shared                             shared;
+    std::atomic<int>                   ready{0};
+    std::atomic<bool>                  start{false};
+    std::atomic<bool>                  stop{false};
+    std::vector<uint64_t>              ops(threadNum);
+    std::vector<std::vector<uint32_t>> waits(threadNum);
+    std::vector<std::thread>           threads;
+    for (int i = 0; i < threadNum; ++i) {
+        threads.emplace_back([&, i]() {
+            if (config.pin) {
+                pinThread(i);
+            }
+            ++ready;
+            while (!start.load(std::memory_order_acquire)) {
+                cpuRelax();
+            }
+            uint64_t n = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                spinWork(outsideWork);
+                bool sample   = (n & 63) == 0;
+                auto begin    = sample ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+                auto acquired = begin;
+                {
+                    std::lock_guard<Lock> guard(lock);
+                    // 持锁时只取时，push_back可能扩容分配内存，放到锁外，不算进临界区
+                    if (sample) {
+                        acquired = std::chrono::steady_clock::now();
+                    }
+                    ++shared.counter;
+                    spinWork(csWork);
+                }
+                if (sample) {
+                    waits[i].push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(acquired - begin).count());
+                }
+                ++n;
+            }
+            ops[i] = n;
+        });
+    }
+    while (ready.load() != threadNum) {
+        std::this_thread::yield();
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(std::chrono::milliseconds(config.durationMs));
+    stop = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    double tm = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    RunResult result;
+    uint64_t  total = 0;
+    for (auto n : ops) {
+        total += n;
+    }
+    if (total != shared.counter) {
+        std::cerr << "lost updates: " << shared.counter << " != " << total << std::endl;
+    }
+    result.opsPerSec = total / tm;
+    auto minmax      = std::minmax_element(ops.begin(), ops.end());
+    result.fairness  = *minmax.second == 0 ? 0 : *minmax.first * 1.0 / *minmax.second;
+    for (auto& w : waits) {
+        result.waits.insert(result.waits.end(), w.begin(), w.end());
+    }
+    return result;
+}
+
+template <class Lock> void runStable(const char* name, const SuiteConfig& config, int threadNum, int csWork,
+                                     int outsideWork, bool first)
+{
+    std::vector<double>   samples;
+    std::vector<uint32_t> waits;
+    double                fairness = 1;
+    double                mean     = 0;
+    double                stddev   = 0;
+    while (true) {
+        RunResult result = runOnce<Lock>(config, threadNum, csWork, outsideWork);
+        samples.push_back(result.opsPerSec);
+        waits.insert(waits.end(), result.waits.begin(), result.waits.end());
+        fairness = std::min(fairness, result.fairness);
+
+        mean = 0;
+        for (auto v : samples) {
+            mean += v;
+        }
+        mean /= samples.size();
+        stddev = 0;
+        for (auto v : samples) {
+            stddev += (v - mean) * (v - mean);
+        }
+        stddev = samples.size() > 1 ? std::sqrt(stddev / (samples.size() - 1)) : 0;
+        int runs = samples.size();
+        if (runs >= config.maxRuns || (runs >= config.minRuns && stddev <= config.cvTarget * mean)) {
+            break;
+        }
+    }
+    std::sort(waits.begin(), waits.end());
+    uint32_t p50 = waits.empty() ? 0 : waits[waits.size() / 2];
+    uint32_t p99 = waits.empty() ? 0 : waits[waits.size() * 99 / 100];
+    double   cv  = mean == 0 ? 0 : stddev / mean;
+    if (config.json) {
+        printf("%s{\"lock\":\"%s\",\"threads\":%d,\"cs\":%d,\"outside\":%d,\"runs\":%zu,\"ops_per_sec\":%.0f,"
+               "\"stddev\":%.0f,\"cv\":%.4f,\"wait_p50_ns\":%u,\"wait_p99_ns\":%u,\"fairness\":%.3f}",
+               first ? "\n" : ",\n", name, threadNum, csWork, outsideWork, samples.size(), mean, stddev, cv, p50,
+               p99, fairness);
+    } else {
+        printf("%s,%d,%d,%d,%zu,%.0f,%.0f,%.4f,%u,%u,%.3f\n", name, threadNum, csWork, outsideWork, samples.size(),
+               mean, stddev, cv, p50, p99, fairness);
+    }
+    fflush(stdout);
+}
+
+struct LockEntry {
+    const char* name;
+    void (*run)(const char*, const SuiteConfig&, int, int, int, bool);
+};
+
+const LockEntry LOCK_ENTRIES[] = {
+    {"tas", runStable<TasSpinLock>},
+    {"ttas", runStable<SpinLock>},
+    {"adaptive", runStable<AdaptiveSpinLock>},
+    {"ticket", runStable<TicketLock>},
+    {"mcs", runStable<McsLock>},
+    {"rwspin", runStable<RWSpinLock>},
+    {"mutex", runStable<std::mutex>},
+    {"ttas+prof", runStable<ProfiledLock<SpinLock>>},
+    {"mutex+prof", runStable<ProfiledMutex>},
+};
+
+void runSuite(const SuiteConfig& config)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                g_cpus.push_back(cpu);
+            }
+        }
+    }
+    if (config.json) {
+        printf("[");
+    } else {
+        printf("lock,threads,cs,outside,runs,ops_per_sec,stddev,cv,wait_p50_ns,wait_p99_ns,fairness\n");
+    }
+    bool first = true;
+    for (auto& entry : LOCK_ENTRIES) {
+        if (!config.locks.empty() &&
+            std::find(config.locks.begin(), config.locks.end(), entry.name) == config.locks.end()) {
+            continue;
+        }
+        for (auto threadNum : config.threads) {
+            for (auto csWork : config.csWork) {
+                for (auto outsideWork : config.outsideWork) {
+                    entry.run(entry.name, config, threadNum, csWork, outsideWork, first);
+                    first = false;
+                }
+            }
+        }
+    }
+    if (config.json) {
+        printf("\n]\n");
+    }
+}
+
+std::vector<std::string> splitList(const char* str)
+{
+    std::vector<std::string> items;
+    std::string              item;
+    for (const char* p = str; ; ++p) {
+        if (*p == ',' || *p == '\0') {
+            if (!item.empty()) {
+                items.push_back(item);
+            }
+            item.clear();
+            if (*p == '\0') {
+                break;
+            }
+        } else {
+            item += *p;
+        }
+    }
+    return items;
+}
+
+std::vector<int> splitInts(const char* str)
+{
+    std::vector<int> values;
+    for (auto& item : splitList(str)) {
+        values.push_back(atoi(item.c_str()));
+    }
+    return values;
+}
+
+// 模拟readh264里每个关键帧都要读的sps/pps：写者整体写入同一个字节，读者检查是否读到撕裂的数据
+struct StreamMeta {
+    uint32_t version;
+    uint8_t  sps[64];
+    uint8_t  pps[32];
+};
+
+inline void fillMeta(StreamMeta& meta, uint32_t version)
+{
+    meta.version = version;
+    memset(meta.sps, static_cast<uint8_t>(version), sizeof(meta.sps));
+    memset(meta.pps, static_cast<uint8_t>(version), sizeof(meta.pps));
+}
+
+inline bool checkMeta(const StreamMeta& meta)
+{
+    uint8_t tag = static_cast<uint8_t>(meta.version);
+    return meta.sps[0] == tag && meta.sps[sizeof(meta.sps) - 1] == tag && meta.pps[0] == tag &&
+           meta.pps[sizeof(meta.pps) - 1] == tag;
+}
+
+// 用互斥锁保护的元数据
+template <class Lock> class LockedMeta {
+    Lock       lock;
+    StreamMeta meta{};
+
+public:
+    StreamMeta load()
+    {
+        std::lock_guard<Lock> guard(lock);
+        return meta;
+    }
+    void store(const StreamMeta& val)
+    {
+        std::lock_guard<Lock> guard(lock);
+        meta = val;
+    }
+};
+
+// 用读写锁保护的元数据
+template <class Lock> class SharedMeta {
+    Lock       lock;
+    StreamMeta meta{};
+
+public:
+    StreamMeta load()
+    {
+        std::shared_lock<Lock> guard(lock);
+        return meta;
+    }
+    void store(const StreamMeta& val)
+    {
+        std::lock_guard<Lock> guard(lock);
+        meta = val;
+    }
+};
+
+// 1个写者每100us更新一次，readerNum个读者持续读取durationMs毫秒
+template <class Meta> void benchMeta(const char* name, int readerNum, int durationMs)
+{
+    Meta       meta;
+    StreamMeta init;
+    fillMeta(init, 0);
+    meta.store(init);
+    std::atomic<bool>        stop{false};
+    std::atomic<long>        reads{0};
+    std::atomic<long>        torn{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readerNum; ++i) {
+        threads.emplace_back([&]() {
+            long localReads = 0;
+            long localTorn  = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                StreamMeta snapshot = meta.load();
+                if (!checkMeta(snapshot)) {
+                    ++localTorn;
+                }
+                ++localReads;
+            }
+            reads += localReads;
+            torn += localTorn;
+        });
+    }
+    threads.emplace_back([&]() {
+        StreamMeta val;
+        for (uint32_t version = 1; !stop.load(std::memory_order_relaxed); ++version) {
+            fillMeta(val, version);
+            meta.store(val);
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(durationMs));
+    stop = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    printf("%-12s %4d %14.0f %8ld\n", name, readerNum, reads * 1000.0 / durationMs, torn.load());
+}
+
+void runMetaBench(int durationMs)
+{
+    const int readerNums[] = {1, 2, 4, 8, 16};
+    printf("%-12s %4s %14s %8s\n", "meta", "rd", "reads/s", "torn");
+    for (auto readerNum : readerNums) {
+        benchMeta<SeqLock<StreamMeta>>("seqlock", readerNum, durationMs);
+        benchMeta<SharedMeta<RWSpinLock>>("rwspin", readerNum, durationMs);
+        benchMeta<SharedMeta<std::shared_mutex>>("shared_mutex", readerNum, durationMs);
+        benchMeta<LockedMeta<SpinLock>>("spinlock", readerNum, durationMs);
+        benchMeta<LockedMeta<std::mutex>>("mutex", readerNum, durationMs);
+    }
+}
+
+
+// ./spinlock [--threads=1,2,4] [--cs=10,200] [--outside=0,200] [--locks=ttas,mutex] [--ms=100]
+//            [--min-runs=3] [--max-runs=20] [--cv=0.05] [--json] [--no-pin]
+// ./spinlock meta [ms]  1写N读下顺序锁、读写锁与互斥锁的读吞吐
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "meta") == 0) {
+        runMetaBench(argc > 2 ? atoi(argv[2]) : 1000);
+        return 0;
+    }
+    SuiteConfig config;
+    for (int i = 1; i < argc; ++i) {
+        const char* arg   = argv[i];
+        const char* value = strchr(arg, '=');
+        value             = value == nullptr ? "" : value + 1;
+        if (strncmp(arg, "--threads=", 10) == 0) {
+            config.threads = splitInts(value);
+        } else if (strncmp(arg, "--cs=", 5) == 0) {
+            config.csWork = splitInts(value);
+        } else if (strncmp(arg, "--outside=", 10) == 0) {
+            config.outsideWork = splitInts(value);
+        } else if (strncmp(arg, "--locks=", 8) == 0) {
+            config.locks = splitList(value);
+        } else if (strncmp(arg, "--ms=", 5) == 0) {
+            config.durationMs = atoi(value);
+        } else if (strncmp(arg, "--min-runs=", 11) == 0) {
+            config.minRuns = atoi(value);
+        } else if (strncmp(arg, "--max-runs=", 11) == 0) {
+            config.maxRuns = atoi(value);
+        } else if (strncmp(arg, "--cv=", 5) == 0) {
+            config.cvTarget = atof(value);
+        } else if (strcmp(arg, "--json") == 0) {
+            config.json = true;
+        } else if (strcmp(arg, "--no-pin") == 0) {
+            config.pin = false;
+        } else {
+            std::cerr << "unknown option: " << arg << std::endl;
+            return -1;
+        }
+    }
+    runSuite(config);
     return 0;
-}
\ No newline at end of file
+}
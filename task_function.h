@@ -0,0 +1,271 @@
+// 任务池公用的任务类型：
+// ErasedStorage<Size>:      类型擦除的小对象存储，不超过Size字节的对象就地存放，更大的回退到堆上
+// TaskFunction<R(Args...)>: 只能移动的可调用对象包装，建立在ErasedStorage上，捕获不超过TASK_INLINE_SIZE字节时
+//                           直接存放在对象内部，不分配堆内存，更大的捕获才回退到堆上；
+//                           需要结果时由调用者自己包一层packaged_task
+// NodePool<T>: 节点对象池，每个线程缓存一批空闲节点，缓存多了整批还给全局栈、空了从全局栈整批取，
+//              稳态下提交/执行任务不再走malloc；节点里的T不析构，vector之类可以复用容量
+#ifndef TASK_FUNCTION_H
+#define TASK_FUNCTION_H
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+const size_t TASK_INLINE_SIZE = 48; // 内联存储大小，够放一个packaged_task/shared_ptr加几个指针或整数
+const size_t NODE_POOL_BATCH  = 64; // 线程缓存与全局栈之间每次搬运的节点数
+
+// 类型擦除的小对象存储，TaskFunction和taskpool的Event共用：
+// 不超过Size字节且移动不抛异常的对象就地存放，否则放在堆上只存指针；只能移动
+template <size_t Size> class ErasedStorage {
+public:
+    ErasedStorage() = default;
+    ErasedStorage(ErasedStorage&& other) noexcept { MoveFrom(other); }
+    ErasedStorage& operator=(ErasedStorage&& other) noexcept
+    {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+    ErasedStorage(const ErasedStorage&)            = delete;
+    ErasedStorage& operator=(const ErasedStorage&) = delete;
+    ~ErasedStorage() { Reset(); }
+
+    // 之前存放的对象先销毁
+    template <class T, class U> void Emplace(U&& value)
+    {
+        Reset();
+        Assign<T>(std::forward<U>(value), std::integral_constant<bool, FitsInline<T>()>());
+    }
+
+    // 存放对象的地址，为空时返回nullptr
+    void* Data()
+    {
+        if (ops_ == nullptr) {
+            return nullptr;
+        }
+        return ops_->heap ? *reinterpret_cast<void**>(&storage_) : static_cast<void*>(&storage_);
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void Reset()
+    {
+        if (ops_ != nullptr) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops {
+        bool heap;
+        void (*move)(void* dst, void* src); // 移动后销毁src
+        void (*destroy)(void*);
+    };
+    using Storage = typename std::aligned_storage<Size, alignof(std::max_align_t)>::type;
+
+    template <class T> static constexpr bool FitsInline()
+    {
+        return sizeof(T) <= sizeof(Storage) && alignof(T) <= alignof(Storage) &&
+               std::is_nothrow_move_constructible<T>::value;
+    }
+
+    template <class T> struct InlineOps {
+        static void Move(void* dst, void* src)
+        {
+            new (dst) T(std::move(*static_cast<T*>(src)));
+            static_cast<T*>(src)->~T();
+        }
+        static void      Destroy(void* p) { static_cast<T*>(p)->~T(); }
+        static const Ops table;
+    };
+
+    template <class T> struct HeapOps {
+        static void      Move(void* dst, void* src) { *static_cast<T**>(dst) = *static_cast<T**>(src); }
+        static void      Destroy(void* p) { delete *static_cast<T**>(p); }
+        static const Ops table;
+    };
+
+    template <class T, class U> void Assign(U&& value, std::true_type)
+    {
+        new (&storage_) T(std::forward<U>(value));
+        ops_ = &InlineOps<T>::table;
+    }
+
+    template <class T, class U> void Assign(U&& value, std::false_type)
+    {
+        *reinterpret_cast<T**>(&storage_) = new T(std::forward<U>(value));
+        ops_                              = &HeapOps<T>::table;
+    }
+
+    void MoveFrom(ErasedStorage& other)
+    {
+        if (other.ops_ != nullptr) {
+            other.ops_->move(&storage_, &other.storage_);
+            ops_       = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    Storage    storage_;
+    const Ops* ops_ = nullptr;
+};
+
+template <size_t Size>
+template <class T>
+const typename ErasedStorage<Size>::Ops ErasedStorage<Size>::InlineOps<T>::table = {false, &InlineOps<T>::Move,
+                                                                                     &InlineOps<T>::Destroy};
+
+template <size_t Size>
+template <class T>
+const typename ErasedStorage<Size>::Ops ErasedStorage<Size>::HeapOps<T>::table = {true, &HeapOps<T>::Move,
+                                                                                   &HeapOps<T>::Destroy};
+
+template <class Sig> class TaskFunction;
+
+template <class R, class... Args> class TaskFunction<R(Args...)> {
+public:
+    TaskFunction() = default;
+    TaskFunction(std::nullptr_t) {}
+
+    template <class F, class Fn = typename std::decay<F>::type,
+              class = typename std::enable_if<!std::is_same<Fn, TaskFunction>::value>::type>
+    TaskFunction(F&& func) : invoke_(&Invoke<Fn>)
+    {
+        storage_.template Emplace<Fn>(std::forward<F>(func));
+    }
+
+    TaskFunction(TaskFunction&&) noexcept            = default;
+    TaskFunction& operator=(TaskFunction&&) noexcept = default;
+    TaskFunction(const TaskFunction&)                = delete;
+    TaskFunction& operator=(const TaskFunction&)     = delete;
+
+    R operator()(Args... args) { return invoke_(storage_.Data(), std::forward<Args>(args)...); }
+
+    explicit operator bool() const { return static_cast<bool>(storage_); }
+
+    void Reset() { storage_.Reset(); }
+
+private:
+    // static_cast<R>: R为void时丢弃返回值，与std::function一致
+    template <class Fn> static R Invoke(void* p, Args&&... args)
+    {
+        return static_cast<R>((*static_cast<Fn*>(p))(std::forward<Args>(args)...));
+    }
+
+    ErasedStorage<TASK_INLINE_SIZE> storage_;
+    R (*invoke_)(void*, Args&&...) = nullptr;
+};
+
+template <class T> class NodePool {
+public:
+    struct Node {
+        T     value;
+        Node* next = nullptr;
+    };
+
+    // 取出的节点value保持上次Release时的状态，由使用者自行清理
+    static Node* Acquire()
+    {
+        LocalCache& cache = Local();
+        if (cache.head == nullptr) {
+            cache.head  = Global().PopBatch();
+            cache.count = NODE_POOL_BATCH;
+            if (cache.head == nullptr) {
+                cache.count = 0;
+                return new Node();
+            }
+        }
+        Node* node = cache.head;
+        cache.head = node->next;
+        --cache.count;
+        node->next = nullptr;
+        return node;
+    }
+
+    static void Release(Node* node)
+    {
+        LocalCache& cache = Local();
+        node->next        = cache.head;
+        cache.head        = node;
+        // 攒够两批后还一批给全局栈，留一批避免在临界点来回搬
+        if (++cache.count >= 2 * NODE_POOL_BATCH) {
+            Global().PushBatch(cache.SplitBatch());
+        }
+    }
+
+private:
+    // 全局栈里每项是一串NODE_POOL_BATCH个节点，一批只加一次锁
+    struct GlobalStack {
+        std::mutex         mutex;
+        std::vector<Node*> batches;
+
+        Node* PopBatch()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (batches.empty()) {
+                return nullptr;
+            }
+            Node* batch = batches.back();
+            batches.pop_back();
+            return batch;
+        }
+        void PushBatch(Node* batch)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batches.push_back(batch);
+        }
+    };
+
+    struct LocalCache {
+        Node*  head  = nullptr;
+        size_t count = 0;
+        // 从头部摘下NODE_POOL_BATCH个节点，调用者保证count足够
+        Node* SplitBatch()
+        {
+            Node* batch = head;
+            Node* tail  = batch;
+            for (size_t i = 1; i < NODE_POOL_BATCH; ++i) {
+                tail = tail->next;
+            }
+            head       = tail->next;
+            tail->next = nullptr;
+            count -= NODE_POOL_BATCH;
+            return batch;
+        }
+
+        // 线程退出时把缓存的节点还回全局，不足一批的直接释放
+        ~LocalCache()
+        {
+            while (count >= NODE_POOL_BATCH) {
+                Global().PushBatch(SplitBatch());
+            }
+            while (head != nullptr) {
+                Node* next = head->next;
+                delete head;
+                head = next;
+            }
+        }
+    };
+
+    static LocalCache& Local()
+    {
+        static thread_local LocalCache cache;
+        return cache;
+    }
+
+    // 故意不释放，避免进程退出时线程缓存的析构晚于全局栈
+    static GlobalStack& Global()
+    {
+        static GlobalStack* stack = new GlobalStack();
+        return *stack;
+    }
+};
+
+#endif // TASK_FUNCTION_H
@@ -0,0 +1,467 @@
+// 轻量future：任务和共享状态放在同一块内存里(按大小分级的对象池，稳态不走malloc)，引用计数管理
+// Then():            结果就绪后把后续任务交给Executor(线程池)执行，不占用任何等待线程
+// WhenAll/WhenAny(): 组合多个future，回调在完成结果的线程上就地执行，只做计数和搬运结果
+// Get()/Wait():      需要阻塞时用futex等待
+// 任务没执行就被丢弃(提交失败、线程池析构)时得到默认值，等待者和后续任务不会永远挂起
+#ifndef TASK_FUTURE_H
+#define TASK_FUTURE_H
+
+#include "task_function.h"
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <linux/futex.h>
+#include <new>
+#include <sys/syscall.h>
+#include <type_traits>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+const size_t FUTURE_BLOCK_MIN = 64;  // 共享状态按2的幂分级复用，最小一级
+const size_t FUTURE_BLOCK_MAX = 512; // 超过的直接new
+
+// 执行后续任务的地方，由线程池实现；停止后仍可能被调用，实现需自行处理(如就地执行)
+class Executor {
+public:
+    virtual void Execute(TaskFunction<void()>&& task) = 0;
+
+protected:
+    ~Executor() = default;
+};
+
+class FutureStateBase {
+public:
+    FutureStateBase()                                  = default;
+    FutureStateBase(const FutureStateBase&)            = delete;
+    FutureStateBase& operator=(const FutureStateBase&) = delete;
+
+    void AddRef() { refs_.fetch_add(1, std::memory_order_relaxed); }
+    void Release()
+    {
+        if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            void* memory           = memory_;
+            void (*release)(void*) = release_;
+            this->~FutureStateBase();
+            release(memory);
+        }
+    }
+
+protected:
+    virtual ~FutureStateBase() = default;
+
+private:
+    template <class S, class... A> friend S* NewFutureState(A&&... args);
+
+    std::atomic<uint32_t> refs_{1};
+    void*                 memory_ = nullptr;
+    void (*release_)(void*)       = nullptr;
+};
+
+template <size_t N> struct FutureBlock {
+    alignas(std::max_align_t) unsigned char bytes[N];
+};
+
+// memory就是对象池节点本身，FutureBlock是节点的第一个成员
+template <size_t N> void ReleaseFutureBlock(void* memory)
+{
+    NodePool<FutureBlock<N>>::Release(static_cast<typename NodePool<FutureBlock<N>>::Node*>(memory));
+}
+
+constexpr size_t FutureBlockSize(size_t size)
+{
+    size_t block = FUTURE_BLOCK_MIN;
+    while (block < size) {
+        block *= 2;
+    }
+    return block;
+}
+
+// 返回的状态带一个引用，由调用者交给StateRef
+template <class S, class... A> S* NewFutureState(A&&... args)
+{
+    constexpr size_t N = FutureBlockSize(sizeof(S));
+    void*            memory;
+    void (*release)(void*);
+    if constexpr (N <= FUTURE_BLOCK_MAX && alignof(S) <= alignof(std::max_align_t)) {
+        memory  = NodePool<FutureBlock<N>>::Acquire();
+        release = &ReleaseFutureBlock<N>;
+    } else {
+        memory  = ::operator new(sizeof(S));
+        release = [](void* p) { ::operator delete(p); };
+    }
+    S* state        = new (memory) S(std::forward<A>(args)...);
+    state->memory_  = memory;
+    state->release_ = release;
+    return state;
+}
+
+// 侵入式引用计数指针
+template <class S> class StateRef {
+public:
+    StateRef() = default;
+    explicit StateRef(S* state) : state_(state) {} // 接管一个已有的引用
+    StateRef(const StateRef& other) : state_(other.state_)
+    {
+        if (state_ != nullptr) {
+            state_->AddRef();
+        }
+    }
+    template <class D> StateRef(const StateRef<D>& other) : state_(other.Get())
+    {
+        if (state_ != nullptr) {
+            state_->AddRef();
+        }
+    }
+    StateRef(StateRef&& other) noexcept : state_(other.state_) { other.state_ = nullptr; }
+    StateRef& operator=(StateRef other) noexcept
+    {
+        std::swap(state_, other.state_);
+        return *this;
+    }
+    ~StateRef()
+    {
+        if (state_ != nullptr) {
+            state_->Release();
+        }
+    }
+
+    S*       Get() const { return state_; }
+    S*       operator->() const { return state_; }
+    explicit operator bool() const { return state_ != nullptr; }
+
+private:
+    S* state_ = nullptr;
+};
+
+// 结果存储，void特化为空
+template <class R> class FutureValue {
+public:
+    FutureValue() = default;
+    ~FutureValue()
+    {
+        if (set_) {
+            Ptr()->~R();
+        }
+    }
+    template <class V> void Set(V&& value)
+    {
+        new (&storage_) R(std::forward<V>(value));
+        set_ = true;
+    }
+    R Take() { return std::move(*Ptr()); }
+
+private:
+    R* Ptr() { return reinterpret_cast<R*>(&storage_); }
+
+    typename std::aligned_storage<sizeof(R), alignof(R)>::type storage_;
+    bool                                                       set_ = false;
+};
+
+template <> class FutureValue<void> {
+public:
+    void Set() {}
+    void Take() {}
+};
+
+template <class R> class FutureState : public FutureStateBase {
+public:
+    explicit FutureState(Executor* executor) : executor_(executor) {}
+
+    bool Ready() const { return (status_.load(std::memory_order_acquire) & STATUS_READY) != 0; }
+
+    // 只能调用一次，调用者需持有引用
+    template <class... V> void SetValue(V&&... value)
+    {
+        value_.Set(std::forward<V>(value)...);
+        uint32_t old = status_.fetch_or(STATUS_READY, std::memory_order_acq_rel);
+        if (old & STATUS_CONTINUATION) {
+            RunContinuation();
+        }
+        if (old & STATUS_WAITING) {
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&status_), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+        }
+    }
+
+    // 执行fn并把返回值设为结果
+    template <class F, class... A> void Invoke(F& fn, A&&... args)
+    {
+        if constexpr (std::is_void<R>::value) {
+            fn(std::forward<A>(args)...);
+            SetValue();
+        } else {
+            SetValue(fn(std::forward<A>(args)...));
+        }
+    }
+
+    // 任务被丢弃时给默认值
+    void Abandon()
+    {
+        if constexpr (std::is_void<R>::value) {
+            SetValue();
+        } else {
+            SetValue(R());
+        }
+    }
+
+    // 只能注册一次，已就绪时立即处理；inlineRun为true时在完成结果的线程上直接执行，只用于很轻的回调
+    void OnReady(TaskFunction<void()>&& continuation, bool inlineRun)
+    {
+        continuation_ = std::move(continuation);
+        inlineRun_    = inlineRun;
+        if (status_.fetch_or(STATUS_CONTINUATION, std::memory_order_acq_rel) & STATUS_READY) {
+            RunContinuation();
+        }
+    }
+
+    void Wait()
+    {
+        uint32_t status = status_.load(std::memory_order_acquire);
+        while (!(status & STATUS_READY)) {
+            status = status_.fetch_or(STATUS_WAITING, std::memory_order_acquire) | STATUS_WAITING;
+            if (!(status & STATUS_READY)) {
+                syscall(SYS_futex, reinterpret_cast<uint32_t*>(&status_), FUTEX_WAIT_PRIVATE, status, nullptr, nullptr,
+                        0);
+            }
+            status = status_.load(std::memory_order_acquire);
+        }
+    }
+
+    FutureValue<R>& Value() { return value_; }
+    Executor*       GetExecutor() const { return executor_; }
+
+private:
+    static const uint32_t STATUS_READY        = 1;
+    static const uint32_t STATUS_CONTINUATION = 2;
+    static const uint32_t STATUS_WAITING      = 4;
+
+    void RunContinuation()
+    {
+        if (inlineRun_ || executor_ == nullptr) {
+            continuation_();
+            continuation_.Reset();
+        } else {
+            executor_->Execute(std::move(continuation_));
+        }
+    }
+
+    Executor* const       executor_;
+    std::atomic<uint32_t> status_{0};
+    bool                  inlineRun_ = false;
+    TaskFunction<void()>  continuation_;
+    FutureValue<R>        value_;
+};
+
+// 放进任务队列的可调用对象，只持有一个引用；没执行就被销毁时给默认结果
+template <class S> class StateRunner {
+public:
+    explicit StateRunner(StateRef<S> state) : state_(std::move(state)) {}
+    StateRunner(StateRunner&& other) noexcept = default;
+    ~StateRunner()
+    {
+        if (state_) {
+            state_->Abandon();
+        }
+    }
+    void operator()()
+    {
+        StateRef<S> state = std::move(state_);
+        state->Run();
+    }
+
+private:
+    StateRef<S> state_;
+};
+
+// 提交的任务本身和它的结果在同一块内存里
+template <class R, class Fn> class TaskState : public FutureState<R> {
+public:
+    template <class F> TaskState(Executor* executor, F&& fn) : FutureState<R>(executor), fn_(std::forward<F>(fn)) {}
+    void Run() { this->Invoke(fn_); }
+
+private:
+    Fn fn_;
+};
+
+template <class R, class F> struct ThenResult {
+    using type = decltype(std::declval<F&>()(std::declval<R>()));
+};
+template <class F> struct ThenResult<void, F> {
+    using type = decltype(std::declval<F&>()());
+};
+
+template <class R> class TaskFuture {
+public:
+    TaskFuture() = default;
+    explicit TaskFuture(StateRef<FutureState<R>> state) : state_(std::move(state)) {}
+
+    bool Valid() const { return static_cast<bool>(state_); }
+    bool Ready() const { return state_ && state_->Ready(); }
+    void Wait() const { state_->Wait(); }
+
+    // 阻塞到就绪并取走结果，之后future失效
+    R Get()
+    {
+        StateRef<FutureState<R>> state = std::move(state_);
+        state->Wait();
+        return state->Value().Take();
+    }
+
+    // 结果就绪后把func(结果)交给同一个Executor执行，返回func结果的future；调用后本future失效
+    template <class F> TaskFuture<typename ThenResult<R, typename std::decay<F>::type>::type> Then(F&& func);
+
+    // 交出共享状态，组合器使用
+    StateRef<FutureState<R>> Detach() { return std::move(state_); }
+
+private:
+    StateRef<FutureState<R>> state_;
+};
+
+template <class R, class R2, class Fn> class ThenState : public FutureState<R2> {
+public:
+    template <class F>
+    ThenState(Executor* executor, StateRef<FutureState<R>> parent, F&& fn)
+        : FutureState<R2>(executor), parent_(std::move(parent)), fn_(std::forward<F>(fn))
+    {
+    }
+    void Run()
+    {
+        StateRef<FutureState<R>> parent = std::move(parent_);
+        if constexpr (std::is_void<R>::value) {
+            this->Invoke(fn_);
+        } else {
+            this->Invoke(fn_, parent->Value().Take());
+        }
+    }
+
+private:
+    StateRef<FutureState<R>> parent_;
+    Fn                       fn_;
+};
+
+template <class R>
+template <class F>
+TaskFuture<typename ThenResult<R, typename std::decay<F>::type>::type> TaskFuture<R>::Then(F&& func)
+{
+    using Fn    = typename std::decay<F>::type;
+    using R2    = typename ThenResult<R, Fn>::type;
+    using State = ThenState<R, R2, Fn>;
+    FutureState<R>* parent = state_.Get();
+    StateRef<State> next(NewFutureState<State>(parent->GetExecutor(), std::move(state_), std::forward<F>(func)));
+    TaskFuture<R2>  result{StateRef<FutureState<R2>>(next)};
+    parent->OnReady(StateRunner<State>(std::move(next)), false);
+    return result;
+}
+
+template <class R> struct WhenAllResult {
+    using type = std::vector<R>;
+};
+template <> struct WhenAllResult<void> {
+    using type = void;
+};
+
+template <class R> class WhenAllState : public FutureState<typename WhenAllResult<R>::type> {
+public:
+    WhenAllState(Executor* executor, size_t count)
+        : FutureState<typename WhenAllResult<R>::type>(executor), remaining_(count)
+    {
+        if constexpr (!std::is_void<R>::value) {
+            values_.resize(count);
+        }
+    }
+    void OnInput(size_t index, FutureState<R>& input)
+    {
+        if constexpr (!std::is_void<R>::value) {
+            values_[index] = input.Value().Take();
+        }
+        if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Finish();
+        }
+    }
+    void Finish()
+    {
+        if constexpr (std::is_void<R>::value) {
+            this->SetValue();
+        } else {
+            this->SetValue(std::move(values_));
+        }
+    }
+
+private:
+    std::atomic<size_t>                                                          remaining_;
+    typename std::conditional<std::is_void<R>::value, char, std::vector<R>>::type values_;
+};
+
+// 全部就绪后得到按输入顺序排列的结果(R为void时没有结果)
+template <class R> TaskFuture<typename WhenAllResult<R>::type> WhenAll(std::vector<TaskFuture<R>> futures)
+{
+    using Result = typename WhenAllResult<R>::type;
+    std::vector<StateRef<FutureState<R>>> inputs;
+    inputs.reserve(futures.size());
+    for (auto& future : futures) {
+        inputs.push_back(future.Detach());
+    }
+    Executor*                 executor = inputs.empty() ? nullptr : inputs[0]->GetExecutor();
+    StateRef<WhenAllState<R>> all(NewFutureState<WhenAllState<R>>(executor, inputs.size()));
+    TaskFuture<Result>        result{StateRef<FutureState<Result>>(all)};
+    if (inputs.empty()) {
+        all->Finish();
+    }
+    // 回调在输入自己的状态里，输入完成时一定还活着，用裸指针避免自引用
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        FutureState<R>* input = inputs[i].Get();
+        input->OnReady([all, input, i]() { all->OnInput(i, *input); }, true);
+    }
+    return result;
+}
+
+template <class R> struct WhenAnyResult {
+    using type = std::pair<size_t, R>; // 最先就绪的下标和它的结果
+};
+template <> struct WhenAnyResult<void> {
+    using type = size_t;
+};
+
+template <class R> class WhenAnyState : public FutureState<typename WhenAnyResult<R>::type> {
+public:
+    explicit WhenAnyState(Executor* executor) : FutureState<typename WhenAnyResult<R>::type>(executor) {}
+    void OnInput(size_t index, FutureState<R>& input)
+    {
+        if (done_.exchange(true, std::memory_order_acq_rel)) {
+            return;
+        }
+        if constexpr (std::is_void<R>::value) {
+            this->SetValue(index);
+        } else {
+            this->SetValue(std::make_pair(index, input.Value().Take()));
+        }
+    }
+
+private:
+    std::atomic<bool> done_{false};
+};
+
+// 任一就绪即完成，其余输入的结果被丢弃；输入为空时立即得到默认值
+template <class R> TaskFuture<typename WhenAnyResult<R>::type> WhenAny(std::vector<TaskFuture<R>> futures)
+{
+    using Result = typename WhenAnyResult<R>::type;
+    std::vector<StateRef<FutureState<R>>> inputs;
+    inputs.reserve(futures.size());
+    for (auto& future : futures) {
+        inputs.push_back(future.Detach());
+    }
+    Executor*                 executor = inputs.empty() ? nullptr : inputs[0]->GetExecutor();
+    StateRef<WhenAnyState<R>> any(NewFutureState<WhenAnyState<R>>(executor));
+    TaskFuture<Result>        result{StateRef<FutureState<Result>>(any)};
+    if (inputs.empty()) {
+        any->Abandon();
+    }
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        FutureState<R>* input = inputs[i].Get();
+        input->OnReady([any, input, i]() { any->OnInput(i, *input); }, true);
+    }
+    return result;
+}
+
+#endif // TASK_FUTURE_H
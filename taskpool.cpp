@@ -1,60 +1,399 @@
+#define BENCH_COUNT_ALLOCS // 统计每个事件的堆分配次数
+#include "async_log.h"
+#include "bench_util.h"
+#include "cpu_affinity.h"
+#include "lock_profiler.h"
+#include "task_function.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
 #include <functional>
 #include <future>
 #include <iostream>
+#include <iterator>
+#include <memory>
 #include <mutex>
-#include <queue>
-#include <sstream>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 using namespace std;
 
-int32_t OnEvent(std::string& event)
+std::atomic<uint64_t> handledEvents{0};                     // 已处理完的事件数，用于统计吞吐
+std::atomic<uint64_t> lostEvents{0};                        // 被拒绝/超时/挤掉而没有执行的事件数
+std::atomic<uint64_t> eventLatencyHist[3][LOCK_PROFILE_BUCKETS]; // 各优先级PushEvent到处理完的耗时，log2(ns)直方图
+std::atomic<uint64_t> keyedLatencyHist[LOCK_PROFILE_BUCKETS];    // 带key事件PushEvent到处理完的耗时
+void HandleWork()
 {
-    stringstream ss;
-    ss << this_thread::get_id();
-    std::string msg = "***thread id " + ss.str() + ", event come:" + event;
-    std::cout << msg << endl << flush;
     int sum = 0;
     // 注意这段代码可能会被某些默认是O2的编译脚本优化掉，要去掉优化
     for (int i = 0; i < 1e3; ++i) {
         sum += i;
     }
+    handledEvents.fetch_add(1, std::memory_order_relaxed);
+}
+
+int32_t OnEvent(std::string& event)
+{
+    LOGD("event come:%s", event.c_str());
+    HandleWork();
     return 0;
 }
 
+std::vector<int64_t>  keyLastSeq;          // 每个key最后处理的事件序号，同一key的事件串行执行，不用加锁
+std::atomic<uint64_t> orderViolations{0}; // 同一key的事件乱序执行的次数
+
+// 带类型的事件负载，key超出keyLastSeq范围时不检查顺序
+struct SeqEvent {
+    uint64_t key;
+    int64_t  seq; // 生产者递增的序号
+};
+
+// 检查同一key是否按提交顺序执行
+void OnSeqEvent(SeqEvent& event)
+{
+    LOGD("event come:%llu/%lld", (unsigned long long)event.key, (long long)event.seq);
+    if (event.key < keyLastSeq.size()) {
+        if (event.seq <= keyLastSeq[event.key]) {
+            orderViolations.fetch_add(1, std::memory_order_relaxed);
+        }
+        keyLastSeq[event.key] = event.seq;
+    }
+    HandleWork();
+}
+
+const int32_t TASK_QUEUE_LIMIT = 10;      // 默认排队(含各线程本地队列)任务数上限，可用SetQueueCapacity修改
+const int32_t LOCAL_QUEUE_SIZE = 1 << 10; // 每个工作线程本地队列的容量，满了就放回全局注入队列
+const int32_t INJECT_BATCH     = 4;       // 工作线程一次从全局注入队列搬到本地队列的任务数
+const int32_t STEAL_ATTEMPTS   = 2;       // 每轮随机挑选victim的次数 = 线程数 * STEAL_ATTEMPTS
+const int32_t EVENT_BATCH_SIZE = 64;      // 事件循环每个任务打包的事件数
+const int32_t STRAND_COUNT     = 64;      // 按key哈希到的串行队列数，不同key可能共用一个，只影响并行度不影响顺序
+const int32_t READY_RING_SIZE  = 256;     // PushReadyTask的无锁就绪环容量，同时排队的这类任务不能超过它
+
+const size_t   EVENT_INLINE_SIZE = 40; // 事件负载内联存储大小，够放一个std::string，更大的类型在堆上分配
+const uint32_t EVENT_ID_MAX      = 64; // 事件ID上限，处理函数表按ID直接索引
+const uint32_t EVENT_ID_STRING   = 0;  // PushEvent(std::string)使用的ID，默认交给OnEvent
+
+// PushTask/TryPushTask返回值
+const int32_t TASK_OK          = 0;
+const int32_t TASK_ERR_FULL    = -1; // 队列满被拒绝
+const int32_t TASK_ERR_TIMEOUT = -2; // 阻塞等待超时
+const int32_t TASK_ERR_STOPPED = -3; // 任务池未启动或已停止
+
+// 队列满时PushTask的处理方式，失败时task保持原样不会被move走(packaged_task版本除外)
+enum class OverloadPolicy {
+    POLICY_BLOCK,       // 阻塞等待空位，timeoutInterval_为0时一直等(原先的行为)，否则超时返回TASK_ERR_TIMEOUT
+    POLICY_REJECT,      // 立即返回TASK_ERR_FULL
+    POLICY_DROP_OLDEST, // 丢弃注入队列里最早的任务(其future得到broken_promise)，再放入新任务
+    POLICY_CALLER_RUNS, // 在提交线程上直接执行
+};
+
+// 任务优先级，数值越小越优先；同一优先级内先进先出
+enum class TaskPriority {
+    PRIORITY_URGENT, // 不受队列容量限制，有空闲就先执行
+    PRIORITY_NORMAL,
+    PRIORITY_BULK,
+};
+const int32_t TASK_PRIORITY_COUNT = 3;
+const int32_t TASK_LANE_READY     = TASK_PRIORITY_COUNT; // PushReadyTask提交的任务，单独统计
+// 各优先级的最长排队时间(ns)，超过后与更高优先级按到期先后竞争，避免低优先级饿死；URGENT为0即入队就到期
+const uint64_t TASK_AGING_NS[TASK_PRIORITY_COUNT] = {0, 20000000, 100000000};
+
+struct OverloadStats {
+    std::atomic<uint64_t> accepted{0};   // 入队成功
+    std::atomic<uint64_t> blocked{0};    // 入队前阻塞等待过
+    std::atomic<uint64_t> timedOut{0};   // 阻塞等待超时
+    std::atomic<uint64_t> rejected{0};   // 队列满被拒绝
+    std::atomic<uint64_t> dropped{0};    // 被后来的任务挤掉
+    std::atomic<uint64_t> callerRuns{0}; // 在提交线程上执行
+};
+
+// 每个优先级的排队统计
+struct LaneStats {
+    std::atomic<uint64_t> executed{0};                     // 已被工作线程取走
+    std::atomic<uint64_t> missed{0};                       // 取走时已超过截止时间
+    std::atomic<uint64_t> waitHist[LOCK_PROFILE_BUCKETS] = {}; // 入队到被取走的耗时，log2(ns)直方图
+};
+
+// 由log2直方图估算分位数，返回所在桶的上界(ns)
+uint64_t HistPercentile(const std::atomic<uint64_t>* hist, double ratio)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < LOCK_PROFILE_BUCKETS; ++i) {
+        total += hist[i].load(std::memory_order_relaxed);
+    }
+    uint64_t acc = 0;
+    for (int i = 0; i < LOCK_PROFILE_BUCKETS; ++i) {
+        acc += hist[i].load(std::memory_order_relaxed);
+        if (total > 0 && acc >= total * ratio) {
+            return 1ull << i;
+        }
+    }
+    return 0;
+}
+
+// Chase-Lev工作窃取队列：所有者在bottom端push/pop(LIFO)，其他线程在top端steal(FIFO)
+// 定长环形数组，满了push返回false由调用者另行处理；元素为指针
+template <class T> class WorkStealingDeque {
+public:
+    WorkStealingDeque(int64_t size) : mask_(size - 1), buffer_(new std::atomic<T*>[size]) {}
+    ~WorkStealingDeque() { delete[] buffer_; }
+
+    // 仅所有者调用
+    bool Push(T* item)
+    {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        int64_t top    = top_.load(std::memory_order_acquire);
+        if (bottom - top > mask_) {
+            return false;
+        }
+        buffer_[bottom & mask_].store(item, std::memory_order_relaxed);
+        // release store代替原算法里的release fence，效果相同，TSan也能识别
+        bottom_.store(bottom + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 仅所有者调用
+    T* Pop()
+    {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+        if (top > bottom) {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = buffer_[bottom & mask_].load(std::memory_order_relaxed);
+        if (top == bottom) {
+            // 只剩最后一个，和窃取者竞争
+            if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                item = nullptr;
+            }
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // 任意线程调用，竞争失败返回nullptr
+    T* Steal()
+    {
+        int64_t top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = bottom_.load(std::memory_order_acquire);
+        if (top >= bottom) {
+            return nullptr;
+        }
+        T* item = buffer_[top & mask_].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return item;
+    }
+
+    bool Empty() const
+    {
+        return top_.load(std::memory_order_relaxed) >= bottom_.load(std::memory_order_relaxed);
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+    const int64_t    mask_;
+    std::atomic<T*>* buffer_;
+};
+
+// 定长的多生产者多消费者无锁环(Vyukov)，每个槽位的seq表示该槽可写还是可读；元素为指针
+template <class T> class ReadyRing {
+public:
+    ReadyRing(size_t size) : mask_(size - 1), slots_(new Slot[size])
+    {
+        for (size_t i = 0; i < size; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+    ~ReadyRing() { delete[] slots_; }
+
+    // 满了返回false
+    bool TryPush(T* item)
+    {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Slot*  slot;
+        while (true) {
+            slot          = &slots_[pos & mask_];
+            intptr_t diff = (intptr_t)slot->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->item = item;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 空时返回nullptr
+    T* TryPop()
+    {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Slot*  slot;
+        while (true) {
+            slot          = &slots_[pos & mask_];
+            intptr_t diff = (intptr_t)slot->seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return nullptr;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        T* item = slot->item;
+        slot->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return item;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        T*                  item = nullptr;
+    };
+    alignas(64) std::atomic<size_t> tail_{0};
+    alignas(64) std::atomic<size_t> head_{0};
+    const size_t mask_;
+    Slot*        slots_;
+};
+
+// 工作窃取任务池：每个工作线程有自己的Chase-Lev队列，外部线程提交的任务按优先级进入注入队列，
+// 工作线程优先处理本地队列，其次从注入队列批量搬运，最后随机挑选其他线程窃取；
+// 有URGENT任务排队或注入队列队头已到期(老化/截止时间)时先取注入队列，本地队列再忙也不会饿死低优先级
+// PLACEMENT_NUMA_NODES时每个节点一组注入队列，工作线程先取、先窃取本节点的任务
+// 派生类的内部调度任务(strand排空)走无锁就绪环，不经过taskMutex_，不占容量
 class TaskPool {
 public:
     using Task      = int32_t(const std::string&);
     using BoundTask = int32_t();
+    using Runnable  = TaskFunction<void()>;
     TaskPool();
-    ~TaskPool();
-    virtual void    PushTask(std::packaged_task<BoundTask>& task);
+    virtual ~TaskPool();
+    // 按当前策略提交，成功返回TASK_OK，捕获不大时不分配堆内存
+    virtual int32_t PushTask(Runnable&& task, TaskPriority priority = TaskPriority::PRIORITY_NORMAL);
+    // 按截止时间提交：离截止越近放进越高的优先级，到期前未被取走时优先于未到期的任务
+    int32_t         PushTask(Runnable&& task, std::chrono::steady_clock::time_point deadline);
+    // 需要结果时使用：future的共享状态要分配一次；失败时task同样已被取走，future得到broken_promise
+    int32_t PushTask(std::packaged_task<BoundTask>& task, TaskPriority priority = TaskPriority::PRIORITY_NORMAL);
+    // 不阻塞，队列满直接返回TASK_ERR_FULL
+    int32_t TryPushTask(Runnable&& task, TaskPriority priority = TaskPriority::PRIORITY_NORMAL);
     virtual void    Stop();
     virtual int32_t Start(int32_t threadNum);
+    // 以下设置需在Start前调用
+    void                 SetPlacement(const PlacementPolicy& placement) { placement_ = placement; }
+    void                 SetQueueCapacity(int32_t capacity) { capacity_ = capacity > 0 ? capacity : 1; }
+    void                 SetOverloadPolicy(OverloadPolicy policy, std::chrono::microseconds timeout = {})
+    {
+        policy_          = policy;
+        timeoutInterval_ = timeout;
+    }
+    const OverloadStats& GetOverloadStats() const { return stats_; }
+    void                 DumpOverloadStats(std::ostream& os) const;
+    const LaneStats&     GetLaneStats(TaskPriority priority) const { return laneStats_[static_cast<int>(priority)]; }
+    // 各优先级及就绪任务的执行数、错过截止时间数和排队耗时p50/p99
+    void                 DumpLaneStats(std::ostream& os) const;
 
 protected:
-    virtual void TaskMainWorker();
-
-    bool                                      isRunning_ = false;
-    std::mutex                                taskMutex_;
-    std::vector<std::thread>                  threads_;
-    std::condition_variable                   hasTask_;
-    std::condition_variable                   acceptNewTask_;
-    std::chrono::microseconds                 timeoutInterval_;
-    std::deque<std::packaged_task<BoundTask>> tasks_;
+    struct QueuedTask {
+        Runnable fn;
+        uint64_t enqueueNs  = 0;
+        uint64_t dueNs      = 0; // 超过该时间后参与按到期先后的竞争
+        uint64_t deadlineNs = 0; // 0表示没有截止时间
+        int32_t  lane       = 0;
+    };
+    using TaskItem = NodePool<QueuedTask>::Node;
+    struct Worker {
+        WorkStealingDeque<TaskItem> tasks{LOCAL_QUEUE_SIZE};
+        uint32_t                    seed;
+        int32_t                     node = 0;
+        std::vector<int>            cpus; // 为空表示不绑定
+    };
+    // 一个节点的注入队列，成员都由taskMutex_保护
+    struct NodeQueue {
+        std::deque<TaskItem*>       lanes[TASK_PRIORITY_COUNT];
+        std::condition_variable_any hasTask;
+        int32_t                     sleepers = 0;
+        std::vector<int32_t>        workers; // 属于该节点的工作线程下标
+    };
+
+    virtual void TaskMainWorker(int32_t index);
+    TaskItem*    TakeTask(Worker& self);
+    TaskItem*    TakeInjected(Worker& self);
+    bool         PickLane(int32_t home, uint64_t now, int32_t& node, int32_t& lane) const;
+    TaskItem*    StealTask(Worker& self);
+    TaskItem*    StealFrom(Worker& self, const int32_t* group, int32_t count);
+    void         NotifyOne(int32_t node);
+    void         NotifyAll();
+    void         OnTaskTaken(TaskItem* task);
+    void         UpdateHeadDue();
+    int32_t      PushTaskWithPolicy(Runnable& task, OverloadPolicy policy, int32_t lane, uint64_t deadlineNs);
+    int32_t      MakeRoom(std::unique_lock<ProfiledMutex>& lock, OverloadPolicy policy, int32_t lane, int32_t node);
+    int32_t      QueuedLoad() const;
+    int32_t      PushReadyTask(Runnable&& task);
+    int32_t      AcquireCapacity(OverloadPolicy policy);
+    void         ReleaseCapacity(int64_t units);
+    // AcquireCapacity的每units份折算一个任务占容量，需在Start前调用
+    void         SetCapacityUnit(int32_t units) { capacityUnit_ = units > 0 ? units : 1; }
+    static void  DropTask(TaskItem* task);
+
+    std::atomic<bool>                       isRunning_{false};
+    ProfiledMutex                           taskMutex_{"TaskPool::taskMutex_"}; // 保护注入队列nodes_
+    std::vector<std::thread>                threads_;
+    std::vector<std::unique_ptr<Worker>>    workers_;
+    std::condition_variable_any             acceptNewTask_;
+    std::chrono::microseconds               timeoutInterval_{0}; // POLICY_BLOCK的等待上限，0表示不限
+    int32_t                                 capacity_ = TASK_QUEUE_LIMIT;
+    OverloadPolicy                          policy_   = OverloadPolicy::POLICY_BLOCK;
+    OverloadStats                           stats_;
+    LaneStats                               laneStats_[TASK_PRIORITY_COUNT + 1]; // 最后一个是TASK_LANE_READY
+    PlacementPolicy                         placement_;
+    int32_t                                 nodeCount_ = 1;
+    std::vector<std::unique_ptr<NodeQueue>> nodes_;
+    std::atomic<uint32_t>                   nextNode_{0};         // 不按节点提交时轮流分配
+    std::atomic<int32_t>                    urgentQueued_{0};     // 注入队列中URGENT任务数，工作线程据此先取注入队列
+    std::atomic<uint64_t>                   headDue_{UINT64_MAX}; // 注入队列各队头最早的到期时间，到期后先取注入队列
+    std::atomic<int32_t>                    pendingTasks_{0};     // 已提交还未被取走执行的任务数
+    std::atomic<int32_t>                    sleepers_{0};         // 在各节点hasTask上睡眠的工作线程数
+    std::atomic<int32_t>                    pushWaiters_{0};      // 在acceptNewTask_上等待的提交线程数
+    ReadyRing<TaskItem>                     readyRing_{READY_RING_SIZE};
+    std::atomic<int32_t>                    readyQueued_{0};      // pendingTasks_中PushReadyTask提交的，不占容量
+    std::atomic<int64_t>                    reservedUnits_{0};    // AcquireCapacity占用还未归还的份数
+    int32_t                                 capacityUnit_ = 1;
+
+    static thread_local TaskPool* currentPool_;
+    static thread_local Worker*   currentWorker_;
 };
+thread_local TaskPool*         TaskPool::currentPool_   = nullptr;
+thread_local TaskPool::Worker* TaskPool::currentWorker_ = nullptr;
+
 TaskPool::TaskPool()
 {
-    cout << "task pool ctor\n" << flush;
+    nodes_.emplace_back(new NodeQueue());
+    LOGI("task pool ctor");
 }
 TaskPool::~TaskPool()
 {
     if (isRunning_) {
         Stop();
     }
-    cout << "task pool dtor\n" << flush;
+    LOGI("task pool dtor");
 }
 
 int32_t TaskPool::Start(int32_t threadNum)
@@ -62,14 +401,29 @@ int32_t TaskPool::Start(int32_t threadNum)
     if (!threads_.empty()) {
         return -1;
     }
+    const CpuTopology& topology = CpuTopology::GetInstance();
+    nodeCount_                  = 1;
+    if (placement_.mode == PlacementMode::PLACEMENT_NUMA_NODES && topology.NodeCount() > 1) {
+        nodeCount_ = std::min(topology.NodeCount(), threadNum);
+    }
+    nodes_.clear();
+    for (int32_t i = 0; i < nodeCount_; ++i) {
+        nodes_.emplace_back(new NodeQueue());
+    }
     isRunning_ = true;
     threads_.reserve(threadNum);
+    workers_.reserve(threadNum);
     for (int i = 0; i < threadNum; ++i) {
-        threads_.push_back(std::thread(&TaskPool::TaskMainWorker, this));
-#ifdef __linux__
-        auto name = "thread" + std::to_string(i);
-        pthread_setname_np(threads_.back().native_handle(), name.c_str());
-#endif
+        workers_.emplace_back(new Worker());
+        Worker& worker = *workers_.back();
+        worker.seed    = i * 2654435761u + 1;
+        worker.cpus    = topology.CpusFor(placement_, i, worker.node);
+        nodes_[worker.node]->workers.push_back(i);
+    }
+    std::string prefix = placement_.namePrefix.empty() ? "thread" : placement_.namePrefix;
+    for (int i = 0; i < threadNum; ++i) {
+        threads_.push_back(std::thread(&TaskPool::TaskMainWorker, this, i));
+        SetThreadName(threads_.back().native_handle(), prefix + std::to_string(i));
     }
     return 0;
 }
@@ -77,64 +431,580 @@ int32_t TaskPool::Start(int32_t threadNum)
 void TaskPool::Stop()
 {
     {
-        std::unique_lock<std::mutex> lock(taskMutex_);
+        std::unique_lock<ProfiledMutex> lock(taskMutex_);
         isRunning_ = false;
-        hasTask_.notify_all();
+        NotifyAll();
+        acceptNewTask_.notify_all();
     }
     for (auto& t : threads_) {
         t.join();
     }
+    // 与原先一致，停止后未执行的任务直接丢弃
+    for (auto& queue : nodes_) {
+        for (auto& lane : queue->lanes) {
+            for (auto task : lane) {
+                DropTask(task);
+            }
+            lane.clear();
+        }
+    }
+    urgentQueued_ = 0;
+    headDue_      = UINT64_MAX;
+    for (auto& worker : workers_) {
+        while (auto task = worker->tasks.Pop()) {
+            DropTask(task);
+        }
+    }
+    while (auto task = readyRing_.TryPop()) {
+        DropTask(task);
+    }
+    readyQueued_ = 0;
 }
 
-void TaskPool::PushTask(std::packaged_task<BoundTask>& task)
+void TaskPool::DropTask(TaskItem* task)
 {
-    if (threads_.empty()) {
-    } else {
-        std::unique_lock<std::mutex> lock(taskMutex_);
-        while (tasks_.size() >= 10) {
-            cout << "task pool overload\n" << flush;
-            hasTask_.notify_all();
-            acceptNewTask_.wait(lock);
-        }
-        tasks_.emplace_back(std::move(task));
-        hasTask_.notify_one();
+    task->value.fn.Reset();
+    NodePool<QueuedTask>::Release(task);
+}
+
+int32_t TaskPool::PushTask(Runnable&& task, TaskPriority priority)
+{
+    return PushTaskWithPolicy(task, policy_, static_cast<int32_t>(priority), 0);
+}
+
+int32_t TaskPool::PushTask(Runnable&& task, std::chrono::steady_clock::time_point deadline)
+{
+    uint64_t deadlineNs =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    uint64_t now   = LockProfiler::NowNs();
+    uint64_t slack = deadlineNs > now ? deadlineNs - now : 0;
+    // 余量不够等NORMAL的老化时间就按URGENT，不够等BULK的就按NORMAL
+    int32_t lane = static_cast<int32_t>(TaskPriority::PRIORITY_BULK);
+    while (lane > 0 && slack < TASK_AGING_NS[lane]) {
+        --lane;
     }
+    return PushTaskWithPolicy(task, policy_, lane, deadlineNs > 0 ? deadlineNs : 1);
 }
 
-void TaskPool::TaskMainWorker()
+int32_t TaskPool::PushTask(std::packaged_task<BoundTask>& task, TaskPriority priority)
 {
-    while (isRunning_) {
-        std::unique_lock<std::mutex> lock(taskMutex_);
-        if (tasks_.empty() && isRunning_) {
-            hasTask_.wait(lock);
-        } else {
-            std::packaged_task<BoundTask> task = std::move(tasks_.front());
-            tasks_.pop_front();
-            stringstream ss1;
-            ss1 << this_thread::get_id();
-            std::string msg1 = "***thread id " + ss1.str() + ", pop task\n";
-            std::cout << msg1 << flush;
-            acceptNewTask_.notify_one();
+    Runnable wrapper([task = std::move(task)]() mutable { task(); });
+    return PushTaskWithPolicy(wrapper, policy_, static_cast<int32_t>(priority), 0);
+}
+
+int32_t TaskPool::TryPushTask(Runnable&& task, TaskPriority priority)
+{
+    return PushTaskWithPolicy(task, OverloadPolicy::POLICY_REJECT, static_cast<int32_t>(priority), 0);
+}
+
+int32_t TaskPool::PushTaskWithPolicy(Runnable& task, OverloadPolicy policy, int32_t lane, uint64_t deadlineNs)
+{
+    if (!isRunning_) {
+        return TASK_ERR_STOPPED;
+    }
+    uint64_t now = LockProfiler::NowNs();
+    uint64_t due = now + TASK_AGING_NS[lane];
+    if (deadlineNs != 0 && deadlineNs < due) {
+        due = deadlineNs;
+    }
+    bool urgent = lane == static_cast<int32_t>(TaskPriority::PRIORITY_URGENT);
+    // 任务里再提交的普通任务直接放进当前线程的本地队列，紧接着就会被本线程执行；
+    // URGENT和带截止时间的任务仍走注入队列，否则会排在本地队列后面，也不参与按到期时间的调度
+    if (currentPool_ == this && !urgent && deadlineNs == 0 && QueuedLoad() < capacity_) {
+        TaskItem* item = NodePool<QueuedTask>::Acquire();
+        item->value    = {std::move(task), now, due, deadlineNs, lane};
+        // 先计数再入队，避免任务被窃取执行后计数短暂为负
+        pendingTasks_.fetch_add(1, std::memory_order_seq_cst);
+        if (currentWorker_->tasks.Push(item)) {
+            stats_.accepted.fetch_add(1, std::memory_order_relaxed);
+            if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+                std::unique_lock<ProfiledMutex> lock(taskMutex_);
+                NotifyOne(currentWorker_->node);
+            }
+            return TASK_OK;
+        }
+        pendingTasks_.fetch_sub(1, std::memory_order_relaxed);
+        task = std::move(item->value.fn);
+        NodePool<QueuedTask>::Release(item);
+    }
+    // 工作线程阻塞等自己池子腾位置可能死锁，改为就地执行
+    if (currentPool_ == this && policy == OverloadPolicy::POLICY_BLOCK) {
+        policy = OverloadPolicy::POLICY_CALLER_RUNS;
+    }
+    int32_t                         node = SubmitNodeFor(placement_, nodeCount_, nextNode_);
+    std::unique_lock<ProfiledMutex> lock(taskMutex_);
+    // URGENT不占容量，也不会被挤掉，批量任务把队列塞满时仍能立即入队
+    if (!urgent && QueuedLoad() >= capacity_) {
+        if (policy == OverloadPolicy::POLICY_CALLER_RUNS) {
             lock.unlock();
-            stringstream ss;
-            ss << this_thread::get_id();
-            std::string msg = "***thread id " + ss.str() + ", exec task\n";
-            std::cout << msg << flush;
+            stats_.callerRuns.fetch_add(1, std::memory_order_relaxed);
             task();
+            return TASK_OK;
+        }
+        int32_t ret = MakeRoom(lock, policy, lane, node);
+        if (ret != TASK_OK) {
+            return ret;
+        }
+    }
+    if (!isRunning_) {
+        return TASK_ERR_STOPPED;
+    }
+    TaskItem* item = NodePool<QueuedTask>::Acquire();
+    item->value    = {std::move(task), now, due, deadlineNs, lane};
+    nodes_[node]->lanes[lane].push_back(item);
+    if (due < headDue_.load(std::memory_order_relaxed)) {
+        headDue_.store(due, std::memory_order_relaxed);
+    }
+    if (urgent) {
+        urgentQueued_.fetch_add(1, std::memory_order_relaxed);
+    }
+    pendingTasks_.fetch_add(1, std::memory_order_relaxed);
+    stats_.accepted.fetch_add(1, std::memory_order_relaxed);
+    if (sleepers_.load(std::memory_order_relaxed) > 0) {
+        NotifyOne(node);
+    }
+    return TASK_OK;
+}
+
+// 持taskMutex_且队列已满时调用：POLICY_BLOCK等到有空位，POLICY_REJECT拒绝，POLICY_DROP_OLDEST挤掉一个
+// 不高于lane的最旧任务；返回TASK_OK表示可以入队，POLICY_CALLER_RUNS由调用者处理
+int32_t TaskPool::MakeRoom(std::unique_lock<ProfiledMutex>& lock, OverloadPolicy policy, int32_t lane, int32_t node)
+{
+    switch (policy) {
+        case OverloadPolicy::POLICY_BLOCK: {
+            stats_.blocked.fetch_add(1, std::memory_order_relaxed);
+            auto deadline = std::chrono::steady_clock::now() + timeoutInterval_;
+            while (QueuedLoad() >= capacity_ && isRunning_) {
+                NotifyAll();
+                pushWaiters_.fetch_add(1, std::memory_order_seq_cst);
+                // 再检查一次，与OnTaskTaken()/ReleaseCapacity()中先减计数再读pushWaiters_配对
+                bool timeout = false;
+                if (QueuedLoad() >= capacity_) {
+                    if (timeoutInterval_.count() == 0) {
+                        acceptNewTask_.wait(lock);
+                    } else {
+                        timeout = acceptNewTask_.wait_until(lock, deadline) == std::cv_status::timeout;
+                    }
+                }
+                pushWaiters_.fetch_sub(1, std::memory_order_relaxed);
+                if (timeout && QueuedLoad() >= capacity_) {
+                    stats_.timedOut.fetch_add(1, std::memory_order_relaxed);
+                    return TASK_ERR_TIMEOUT;
+                }
+            }
+            break;
+        }
+        case OverloadPolicy::POLICY_REJECT:
+            stats_.rejected.fetch_add(1, std::memory_order_relaxed);
+            return TASK_ERR_FULL;
+        case OverloadPolicy::POLICY_DROP_OLDEST: {
+            // 从最低优先级挤起，不挤比新任务优先级高的，同一优先级先挤本节点的；
+            // 积压的任务都已被工作线程取走时无可丢弃，只能拒绝
+            std::deque<TaskItem*>* victim = nullptr;
+            for (int32_t i = TASK_PRIORITY_COUNT - 1; i >= lane && victim == nullptr; --i) {
+                for (int32_t j = 0; j < nodeCount_; ++j) {
+                    std::deque<TaskItem*>& tasks = nodes_[(node + j) % nodeCount_]->lanes[i];
+                    if (!tasks.empty()) {
+                        victim = &tasks;
+                        break;
+                    }
+                }
+            }
+            if (victim == nullptr) {
+                stats_.rejected.fetch_add(1, std::memory_order_relaxed);
+                return TASK_ERR_FULL;
+            }
+            DropTask(victim->front());
+            victim->pop_front();
+            UpdateHeadDue();
+            pendingTasks_.fetch_sub(1, std::memory_order_relaxed);
+            stats_.dropped.fetch_add(1, std::memory_order_relaxed);
+            break;
         }
+        case OverloadPolicy::POLICY_CALLER_RUNS:
+            break;
     }
+    return TASK_OK;
 }
+
+// 占容量的排队量：PushReadyTask提交的不算，AcquireCapacity占用的按capacityUnit_份折算一个任务
+int32_t TaskPool::QueuedLoad() const
+{
+    int64_t units = reservedUnits_.load(std::memory_order_seq_cst);
+    return pendingTasks_.load(std::memory_order_seq_cst) - readyQueued_.load(std::memory_order_seq_cst) +
+           static_cast<int32_t>((units + capacityUnit_ - 1) / capacityUnit_);
+}
+
+// 派生类内部调度用：放进当前工作线程的本地队列或无锁就绪环，不经过taskMutex_，不占容量也不会被
+// DROP_OLDEST挤掉；调用者保证同时排队的这类任务不超过READY_RING_SIZE，Stop后未执行的同样被丢弃
+int32_t TaskPool::PushReadyTask(Runnable&& task)
+{
+    if (!isRunning_) {
+        return TASK_ERR_STOPPED;
+    }
+    uint64_t  now  = LockProfiler::NowNs();
+    TaskItem* item = NodePool<QueuedTask>::Acquire();
+    item->value    = {std::move(task), now, now, 0, TASK_LANE_READY};
+    readyQueued_.fetch_add(1, std::memory_order_seq_cst);
+    pendingTasks_.fetch_add(1, std::memory_order_seq_cst);
+    if (currentPool_ != this || !currentWorker_->tasks.Push(item)) {
+        while (!readyRing_.TryPush(item)) {
+            std::this_thread::yield();
+        }
+        // 与Stop()先清isRunning_再清空就绪环配对：晚于清空放进来的由提交者自己丢弃
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!isRunning_) {
+            while (auto stale = readyRing_.TryPop()) {
+                DropTask(stale);
+            }
+            return TASK_OK;
+        }
+    }
+    if (sleepers_.load(std::memory_order_seq_cst) > 0) {
+        std::unique_lock<ProfiledMutex> lock(taskMutex_);
+        NotifyOne(currentPool_ == this ? currentWorker_->node : 0);
+    }
+    return TASK_OK;
+}
+
+// 为不进任务队列的工作(如EventManager的带key事件)占一份容量，满了按policy处理，与PushTask计入同样的统计；
+// 这类工作不能在提交线程上就地执行，POLICY_CALLER_RUNS和工作线程上的POLICY_BLOCK改为超额占用
+int32_t TaskPool::AcquireCapacity(OverloadPolicy policy)
+{
+    if (!isRunning_) {
+        return TASK_ERR_STOPPED;
+    }
+    bool overcommit = policy == OverloadPolicy::POLICY_CALLER_RUNS ||
+                      (currentPool_ == this && policy == OverloadPolicy::POLICY_BLOCK);
+    if (!overcommit && QueuedLoad() >= capacity_) {
+        int32_t                         node = SubmitNodeFor(placement_, nodeCount_, nextNode_);
+        std::unique_lock<ProfiledMutex> lock(taskMutex_);
+        if (QueuedLoad() >= capacity_) {
+            int32_t ret = MakeRoom(lock, policy, static_cast<int32_t>(TaskPriority::PRIORITY_NORMAL), node);
+            if (ret != TASK_OK) {
+                return ret;
+            }
+        }
+        if (!isRunning_) {
+            return TASK_ERR_STOPPED;
+        }
+    }
+    reservedUnits_.fetch_add(1, std::memory_order_seq_cst);
+    stats_.accepted.fetch_add(1, std::memory_order_relaxed);
+    return TASK_OK;
+}
+
+// 归还AcquireCapacity占用的units份，唤醒等空位的提交线程
+void TaskPool::ReleaseCapacity(int64_t units)
+{
+    reservedUnits_.fetch_sub(units, std::memory_order_seq_cst);
+    if (pushWaiters_.load(std::memory_order_seq_cst) > 0) {
+        std::unique_lock<ProfiledMutex> lock(taskMutex_);
+        acceptNewTask_.notify_all();
+    }
+}
+
+void TaskPool::DumpOverloadStats(std::ostream& os) const
+{
+    os << "{\"capacity\":" << capacity_ << ",\"accepted\":" << stats_.accepted.load(std::memory_order_relaxed)
+       << ",\"blocked\":" << stats_.blocked.load(std::memory_order_relaxed)
+       << ",\"timed_out\":" << stats_.timedOut.load(std::memory_order_relaxed)
+       << ",\"rejected\":" << stats_.rejected.load(std::memory_order_relaxed)
+       << ",\"dropped\":" << stats_.dropped.load(std::memory_order_relaxed)
+       << ",\"caller_runs\":" << stats_.callerRuns.load(std::memory_order_relaxed) << "}\n";
+}
+
+void TaskPool::DumpLaneStats(std::ostream& os) const
+{
+    static const char* names[TASK_PRIORITY_COUNT + 1] = {"urgent", "normal", "bulk", "ready"};
+    os << "{\"lanes\":[";
+    for (int32_t i = 0; i <= TASK_LANE_READY; ++i) {
+        const LaneStats& lane = laneStats_[i];
+        os << (i == 0 ? "" : ",") << "{\"name\":\"" << names[i]
+           << "\",\"executed\":" << lane.executed.load(std::memory_order_relaxed)
+           << ",\"missed_deadline\":" << lane.missed.load(std::memory_order_relaxed)
+           << ",\"wait_p50_ns\":" << HistPercentile(lane.waitHist, 0.5)
+           << ",\"wait_p99_ns\":" << HistPercentile(lane.waitHist, 0.99) << "}";
+    }
+    os << "]}\n";
+}
+
+void TaskPool::OnTaskTaken(TaskItem* task)
+{
+    uint64_t   now  = LockProfiler::NowNs();
+    LaneStats& lane = laneStats_[task->value.lane];
+    lane.executed.fetch_add(1, std::memory_order_relaxed);
+    lane.waitHist[LockProfiler::Bucket(now - task->value.enqueueNs)].fetch_add(1, std::memory_order_relaxed);
+    if (task->value.deadlineNs != 0 && now > task->value.deadlineNs) {
+        lane.missed.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (task->value.lane == TASK_LANE_READY) {
+        // 不占容量，腾不出空位，不必唤醒提交线程
+        readyQueued_.fetch_sub(1, std::memory_order_seq_cst);
+        pendingTasks_.fetch_sub(1, std::memory_order_seq_cst);
+        return;
+    }
+    pendingTasks_.fetch_sub(1, std::memory_order_seq_cst);
+    if (pushWaiters_.load(std::memory_order_seq_cst) > 0) {
+        std::unique_lock<ProfiledMutex> lock(taskMutex_);
+        acceptNewTask_.notify_one();
+    }
+}
+
+// 持taskMutex_调用：队头已到期的优先级里取最早到期的，都没到期就取最高优先级；
+// 优先级相同时home节点优先，各节点都空返回false
+bool TaskPool::PickLane(int32_t home, uint64_t now, int32_t& node, int32_t& lane) const
+{
+    bool     picked = false;
+    uint64_t due    = 0;
+    for (int32_t i = 0; i < TASK_PRIORITY_COUNT; ++i) {
+        for (int32_t j = 0; j < nodeCount_; ++j) {
+            int32_t                      n     = (home + j) % nodeCount_;
+            const std::deque<TaskItem*>& tasks = nodes_[n]->lanes[i];
+            if (tasks.empty()) {
+                continue;
+            }
+            uint64_t headDue = tasks.front()->value.dueNs;
+            if (!picked || (headDue <= now && headDue < due)) {
+                picked = true;
+                node   = n;
+                lane   = i;
+                due    = headDue;
+            }
+        }
+    }
+    return picked;
+}
+
+// 持taskMutex_调用，注入队列出队后重算headDue_；入队只会让它变小，直接比较即可
+void TaskPool::UpdateHeadDue()
+{
+    uint64_t due = UINT64_MAX;
+    for (auto& queue : nodes_) {
+        for (auto& lane : queue->lanes) {
+            if (!lane.empty()) {
+                due = std::min(due, lane.front()->value.dueNs);
+            }
+        }
+    }
+    headDue_.store(due, std::memory_order_relaxed);
+}
+
+// 持taskMutex_调用：优先唤醒node上睡眠的线程，该节点没有就唤醒其他节点的，有任务时总有线程去取
+void TaskPool::NotifyOne(int32_t node)
+{
+    for (int32_t i = 0; i < nodeCount_; ++i) {
+        NodeQueue& queue = *nodes_[(node + i) % nodeCount_];
+        if (queue.sleepers > 0) {
+            queue.hasTask.notify_one();
+            return;
+        }
+    }
+}
+
+// 持taskMutex_调用
+void TaskPool::NotifyAll()
+{
+    for (auto& queue : nodes_) {
+        queue->hasTask.notify_all();
+    }
+}
+
+// 持taskMutex_调用
+TaskPool::TaskItem* TaskPool::TakeInjected(Worker& self)
+{
+    int32_t node = 0;
+    int32_t lane = 0;
+    if (!PickLane(self.node, LockProfiler::NowNs(), node, lane)) {
+        return nullptr;
+    }
+    std::deque<TaskItem*>& tasks = nodes_[node]->lanes[lane];
+    TaskItem*              task  = tasks.front();
+    tasks.pop_front();
+    if (lane == static_cast<int32_t>(TaskPriority::PRIORITY_URGENT)) {
+        // URGENT不搬到本地队列，免得排在本线程的其他任务后面
+        urgentQueued_.fetch_sub(1, std::memory_order_relaxed);
+        UpdateHeadDue();
+        if (!tasks.empty() && sleepers_.load(std::memory_order_relaxed) > 0) {
+            NotifyOne(node);
+        }
+        return task;
+    }
+    // 同一优先级多搬几个到本地队列，减少对taskMutex_的争用；搬过来的可以被其他线程窃取
+    for (int32_t i = 1; i < INJECT_BATCH && !tasks.empty(); ++i) {
+        if (!self.tasks.Push(tasks.front())) {
+            break;
+        }
+        tasks.pop_front();
+    }
+    UpdateHeadDue();
+    if (!self.tasks.Empty() && sleepers_.load(std::memory_order_relaxed) > 0) {
+        NotifyOne(self.node);
+    }
+    return task;
+}
+
+// 多节点时先在本节点内挑victim，窃取不到再跨节点
+TaskPool::TaskItem* TaskPool::StealTask(Worker& self)
+{
+    if (nodeCount_ > 1) {
+        const std::vector<int32_t>& group = nodes_[self.node]->workers;
+        if (TaskItem* task = StealFrom(self, group.data(), static_cast<int32_t>(group.size()))) {
+            return task;
+        }
+    }
+    return StealFrom(self, nullptr, static_cast<int32_t>(workers_.size()));
+}
+
+// group为nullptr时在全部工作线程中挑选
+TaskPool::TaskItem* TaskPool::StealFrom(Worker& self, const int32_t* group, int32_t count)
+{
+    for (int32_t i = 0; i < count * STEAL_ATTEMPTS; ++i) {
+        self.seed ^= self.seed << 13;
+        self.seed ^= self.seed >> 17;
+        self.seed ^= self.seed << 5;
+        int32_t index  = self.seed % count;
+        Worker* victim = workers_[group == nullptr ? index : group[index]].get();
+        // 先用relaxed读粗略判断，空队列不必走Steal()里的屏障和CAS
+        if (victim == &self || victim->tasks.Empty()) {
+            continue;
+        }
+        if (TaskItem* task = victim->tasks.Steal()) {
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+// 就绪环 -> 本地队列 -> 窃取 -> 全局注入队列，都没有则睡眠；返回nullptr时调用者重新检查isRunning_
+// 有URGENT任务排队或注入队列队头已到期时先取注入队列，本地队列一直有任务时注入队列也会按老化时间被取到
+TaskPool::TaskItem* TaskPool::TakeTask(Worker& self)
+{
+    uint64_t headDue = headDue_.load(std::memory_order_relaxed);
+    if (urgentQueued_.load(std::memory_order_relaxed) > 0 ||
+        (headDue != UINT64_MAX && headDue <= LockProfiler::NowNs())) {
+        std::unique_lock<ProfiledMutex> lock(taskMutex_);
+        if (TaskItem* task = TakeInjected(self)) {
+            return task;
+        }
+    }
+    // 就绪环在本地队列之前取，本地队列一直有任务时也不会被饿住
+    if (TaskItem* task = readyRing_.TryPop()) {
+        return task;
+    }
+    if (TaskItem* task = self.tasks.Pop()) {
+        return task;
+    }
+    if (TaskItem* task = StealTask(self)) {
+        return task;
+    }
+    std::unique_lock<ProfiledMutex> lock(taskMutex_);
+    if (TaskItem* task = TakeInjected(self)) {
+        return task;
+    }
+    // 先登记sleepers_再检查pendingTasks_，与PushTask中先加pendingTasks_再读sleepers_配对，避免漏唤醒
+    NodeQueue& home = *nodes_[self.node];
+    ++home.sleepers;
+    sleepers_.fetch_add(1, std::memory_order_seq_cst);
+    if (pendingTasks_.load(std::memory_order_seq_cst) == 0 && isRunning_) {
+        home.hasTask.wait(lock);
+    }
+    sleepers_.fetch_sub(1, std::memory_order_relaxed);
+    --home.sleepers;
+    return nullptr;
+}
+
+void TaskPool::TaskMainWorker(int32_t index)
+{
+    Worker& self   = *workers_[index];
+    currentPool_   = this;
+    currentWorker_ = &self;
+    // 在线程自己身上绑定，之后线程局部缓存、对象池节点都在所在节点上首次分配
+    if (BindCurrentThread(self.cpus) != 0) {
+        LOGW("worker %d: bind to %zu cpus failed", index, self.cpus.size());
+    }
+    while (isRunning_) {
+        TaskItem* task = TakeTask(self);
+        if (task == nullptr) {
+            continue;
+        }
+        OnTaskTaken(task);
+        // 每个任务一条调试日志，低于ASYNC_LOG_LEVEL时编译期去掉
+        LOGD("pop task, exec task, lane %d", task->value.lane);
+        task->value.fn();
+        DropTask(task);
+    }
+    currentPool_   = nullptr;
+    currentWorker_ = nullptr;
+}
+
+// 带类型的事件：ID加任意可移动的负载，负载不超过EVENT_INLINE_SIZE时就地存放；只能移动，从生产者到处理函数不拷贝
+class Event {
+public:
+    Event() = default;
+    template <class T, class Td = typename std::decay<T>::type>
+    Event(uint32_t id, T&& payload) : id_(id), type_(TypeOf<Td>())
+    {
+        payload_.template Emplace<Td>(std::forward<T>(payload));
+    }
+    Event(Event&&) noexcept            = default;
+    Event& operator=(Event&&) noexcept = default;
+    Event(const Event&)                = delete;
+    Event& operator=(const Event&)     = delete;
+
+    // 每个负载类型一个唯一地址，用于和注册的处理函数比对
+    template <class T> static const void* TypeOf()
+    {
+        static const char tag = 0;
+        return &tag;
+    }
+
+    uint32_t    Id() const { return id_; }
+    const void* Type() const { return type_; }
+    void*       Data() { return payload_.Data(); }
+    void        Reset() { payload_.Reset(); }
+
+    uint64_t pushNs = 0; // 入队时间，统计延迟用
+
+private:
+    ErasedStorage<EVENT_INLINE_SIZE> payload_;
+    uint32_t                         id_   = 0;
+    const void*                      type_ = nullptr;
+};
+
+// 事件循环一次取走全部积压事件，按优先级分别以batchSize_打包成任务交给任务池，每批只需一次PushTask
+// 带key的事件不经过事件循环，直接进入按key哈希的strand，同一strand同时只有一个排空任务在执行
+// 事件按ID分发给RegisterHandler注册的处理函数，字符串事件是ID为EVENT_ID_STRING的一种
 class EventManager : public TaskPool {
 public:
-    EventManager() { cout << "event manager ctor\n" << flush; }
-    ~EventManager() { cout << "event manager dtor\n" << flush; }
+    EventManager() : strands_(new Strand[STRAND_COUNT])
+    {
+        RegisterHandler<std::string>(EVENT_ID_STRING, [](std::string& event) { OnEvent(event); });
+        LOGI("event manager ctor");
+    }
+    // strands_先于~TaskPool析构，必须在这里停掉工作线程，否则排空任务可能访问已释放的strand
+    ~EventManager()
+    {
+        if (isRunning_) {
+            StopEventLoop();
+        }
+        LOGI("event manager dtor");
+    }
+    // 停止后仍在strand里排队的带key事件随排空任务一起丢弃，计入lostEvents
     void StopEventLoop()
     {
         Stop();
-        eventThread_.join();
+        {
+            std::unique_lock<ProfiledMutex> lock(mutex_);
+            hasEvent_.notify_all();
+        }
+        if (eventThread_.joinable()) {
+            eventThread_.join();
+        }
     }
     int32_t StartEventLoop()
     {
+        SetCapacityUnit(batchSize_);
         int ret = Start(10);
         if (ret != 0) {
             return ret;
@@ -145,66 +1015,327 @@ public:
 #endif
         return 0;
     }
-    int32_t PushEvent(const std::string& event)
+    // 处理函数在工作线程上并发调用，需自行保证线程安全；需在StartEventLoop前注册，ID越界返回-1
+    template <class T> int32_t RegisterHandler(uint32_t id, TaskFunction<void(T&)>&& handler)
     {
-        std::unique_lock<std::mutex> lock(mutex_);
-        events_.emplace(event);
-        hasEvent_.notify_one();
+        if (id >= EVENT_ID_MAX) {
+            return -1;
+        }
+        handlers_[id].type = Event::TypeOf<T>();
+        handlers_[id].fn   = [handler = std::move(handler)](void* payload) mutable {
+            handler(*static_cast<T*>(payload));
+        };
+        return 0;
+    }
+    // 兼容原来的字符串事件，按值传入后移动进事件负载，传临时字符串时不拷贝
+    int32_t PushEvent(std::string event, TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+    {
+        return PushEvent(Event(EVENT_ID_STRING, std::move(event)), priority);
+    }
+    int32_t PushEvent(Event&& event, TaskPriority priority = TaskPriority::PRIORITY_NORMAL)
+    {
+        if (event.Id() >= EVENT_ID_MAX) {
+            return -1;
+        }
+        if (!isRunning_) {
+            return TASK_ERR_STOPPED;
+        }
+        event.pushNs = LockProfiler::NowNs();
+        std::unique_lock<ProfiledMutex> lock(mutex_);
+        events_[static_cast<int>(priority)].push_back(std::move(event));
+        // 事件循环只在队列为空时睡眠
+        if (++queuedEvents_ == 1) {
+            hasEvent_.notify_one();
+        }
         return 0;
     }
+    // 同一key的事件按提交顺序串行执行，不同key可在任意空闲线程上并行；无锁，不占用事件循环
+    // 与不带key的事件一样受队列容量和过载策略约束，每batchSize_个排队事件折算一个任务，被拒绝/超时计入lostEvents
+    int32_t PushEvent(uint64_t key, std::string event)
+    {
+        return PushEvent(key, Event(EVENT_ID_STRING, std::move(event)));
+    }
+    int32_t PushEvent(uint64_t key, Event&& event)
+    {
+        if (event.Id() >= EVENT_ID_MAX) {
+            return -1;
+        }
+        int32_t ret = AcquireCapacity(policy_);
+        if (ret != TASK_OK) {
+            if (ret != TASK_ERR_STOPPED) {
+                lostEvents.fetch_add(1, std::memory_order_relaxed);
+            }
+            return ret;
+        }
+        event.pushNs       = LockProfiler::NowNs();
+        Strand&     strand = strands_[(key * 0x9E3779B97F4A7C15ull >> 32) % STRAND_COUNT];
+        StrandItem* item   = NodePool<StrandEvent>::Acquire();
+        item->value.event  = std::move(event);
+        item->value.link.store(nullptr, std::memory_order_relaxed);
+        StrandItem* prev = strand.head.exchange(item, std::memory_order_acq_rel);
+        prev->value.link.store(item, std::memory_order_release);
+        // 计数从0变1的生产者负责调度排空任务，排空完之前不会再有第二个
+        if (strand.count.fetch_add(1, std::memory_order_acq_rel) == 0) {
+            ScheduleStrand(strand);
+        }
+        return 0;
+    }
+    // 需在StartEventLoop前调用
+    void SetEventBatch(int32_t batchSize) { batchSize_ = batchSize > 0 ? batchSize : 1; }
 
 private:
+    struct Handler {
+        const void*               type = nullptr; // 负载类型，与事件不符时丢弃
+        TaskFunction<void(void*)> fn;
+    };
+    using EventVector = std::vector<Event>;
+    // 一批事件，vector来自对象池以复用容量；未执行就被销毁(拒绝/超时/被挤掉)时计入lostEvents
+    struct EventBatch {
+        EventManager*                owner;
+        NodePool<EventVector>::Node* node;
+        int32_t                      lane;
+        EventBatch(EventManager* owner, int32_t lane)
+            : owner(owner), node(NodePool<EventVector>::Acquire()), lane(lane)
+        {
+        }
+        EventBatch(EventBatch&& other) noexcept : owner(other.owner), node(other.node), lane(other.lane)
+        {
+            other.node = nullptr;
+        }
+        EventBatch& operator=(EventBatch&&) = delete;
+        ~EventBatch()
+        {
+            if (node != nullptr) {
+                lostEvents.fetch_add(node->value.size(), std::memory_order_relaxed);
+                node->value.clear();
+                NodePool<EventVector>::Release(node);
+            }
+        }
+        void operator()()
+        {
+            for (auto& event : node->value) {
+                owner->Dispatch(event);
+                uint64_t cost = LockProfiler::NowNs() - event.pushNs;
+                eventLatencyHist[lane][LockProfiler::Bucket(cost)].fetch_add(1, std::memory_order_relaxed);
+            }
+            node->value.clear();
+        }
+    };
+
+    struct StrandEvent {
+        Event                                     event;
+        std::atomic<NodePool<StrandEvent>::Node*> link{nullptr};
+    };
+    using StrandItem = NodePool<StrandEvent>::Node;
+    // 多生产者单消费者的无锁链表队列，tail是已处理过的哑元节点，取走下一个时释放
+    struct alignas(64) Strand {
+        std::atomic<StrandItem*> head{NodePool<StrandEvent>::Acquire()};
+        StrandItem*              tail = head.load(std::memory_order_relaxed); // 仅排空任务访问
+        std::atomic<int64_t>     count{0}; // 已链入还未处理的事件数
+        Strand() { tail->value.link.store(nullptr, std::memory_order_relaxed); }
+        ~Strand()
+        {
+            while (tail != nullptr) {
+                StrandItem* next = tail->value.link.load(std::memory_order_relaxed);
+                if (next != nullptr) {
+                    lostEvents.fetch_add(1, std::memory_order_relaxed);
+                }
+                tail->value.event.Reset();
+                NodePool<StrandEvent>::Release(tail);
+                tail = next;
+            }
+        }
+    };
+
+    // 排空任务，持有strand的消费权；没执行就被销毁(任务池已停止，提交失败或被Stop丢弃)时，
+    // 在析构里丢掉剩余事件并把计数清零，否则计数一直大于0，之后不会再有人调度这个strand
+    struct StrandDrain {
+        EventManager* owner;
+        Strand*       strand;
+        StrandDrain(EventManager* owner, Strand* strand) : owner(owner), strand(strand) {}
+        StrandDrain(StrandDrain&& other) noexcept : owner(other.owner), strand(other.strand)
+        {
+            other.strand = nullptr;
+        }
+        StrandDrain& operator=(StrandDrain&&) = delete;
+        ~StrandDrain()
+        {
+            if (strand != nullptr) {
+                // 循环而不是每批重新调度，剩余再多也不会压栈
+                while (owner->DrainBatch(*strand, false)) {
+                }
+            }
+        }
+        void operator()()
+        {
+            Strand* target = strand;
+            strand         = nullptr;
+            if (owner->DrainBatch(*target, true)) {
+                owner->ScheduleStrand(*target);
+            }
+        }
+    };
+
+    // 排空任务最多STRAND_COUNT个，走PushReadyTask：事件入strand时已占过容量，也不会被DROP_OLDEST挤掉让strand卡死
+    static_assert(STRAND_COUNT <= READY_RING_SIZE, "strand drains must fit in the ready ring");
+    void ScheduleStrand(Strand& strand) { PushReadyTask(StrandDrain(this, &strand)); }
+
+    // 每次最多处理batchSize_个，返回是否还有剩余；有剩余时重新调度，长队列的strand不会一直占着一个线程
+    // dispatch为false时只丢弃，计入lostEvents；处理完的事件归还占用的容量
+    bool DrainBatch(Strand& strand, bool dispatch)
+    {
+        int64_t count = std::min<int64_t>(strand.count.load(std::memory_order_acquire), batchSize_);
+        for (int64_t i = 0; i < count; ++i) {
+            StrandItem* next;
+            // 生产者交换head后、链接前被切走时，计数可能已被后来者加上，等它链好
+            while ((next = strand.tail->value.link.load(std::memory_order_acquire)) == nullptr) {
+                std::this_thread::yield();
+            }
+            NodePool<StrandEvent>::Release(strand.tail);
+            strand.tail = next;
+            if (!dispatch) {
+                next->value.event.Reset();
+                lostEvents.fetch_add(1, std::memory_order_relaxed);
+                continue;
+            }
+            Dispatch(next->value.event);
+            uint64_t cost = LockProfiler::NowNs() - next->value.event.pushNs;
+            keyedLatencyHist[LockProfiler::Bucket(cost)].fetch_add(1, std::memory_order_relaxed);
+        }
+        ReleaseCapacity(count);
+        return strand.count.fetch_sub(count, std::memory_order_acq_rel) > count;
+    }
+
+    // 执行完即释放负载，节点或vector回到对象池时不再持有资源
+    void Dispatch(Event& event)
+    {
+        Handler& handler = handlers_[event.Id()];
+        if (handler.type != event.Type() || !handler.fn) {
+            LOGE_RATE(10, "event %u: no handler for this payload type, dropped", event.Id());
+            lostEvents.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            handler.fn(event.Data());
+        }
+        event.Reset();
+    }
+
     void ProcessEvent()
     {
-        std::unique_lock<std::mutex> lock(mutex_);
+        // 与events_交替使用，两边的容量都能复用
+        EventVector pending[TASK_PRIORITY_COUNT];
         while (isRunning_) {
-            if (events_.empty()) {
-                hasEvent_.wait(lock);
-            } else {
-                auto event = events_.front();
-                events_.pop();
-                lock.unlock();
-                std::packaged_task<BoundTask> task(std::bind(&OnEvent, event));
-                // auto future = task.get_future(); // sync mode
-                // std::cout << "==========push event: " << event << endl << flush;
-                PushTask(task);
-                lock.lock();
-                // sync mode
-                // if (future.wait_for(std::chrono::milliseconds(1000 * 5)) == std::future_status::ready) {
-                //     std::cout << "=========future: " << future.get() << endl << flush;
-                // } else {
-
-                //     std::cout << "=========future: fail " << endl << flush;
-                // }
+            {
+                std::unique_lock<ProfiledMutex> lock(mutex_);
+                while (queuedEvents_ == 0 && isRunning_) {
+                    hasEvent_.wait(lock);
+                }
+                for (int32_t i = 0; i < TASK_PRIORITY_COUNT; ++i) {
+                    pending[i].swap(events_[i]);
+                }
+                queuedEvents_ = 0;
+            }
+            // 高优先级先提交，POLICY_BLOCK时不会被排在后面的批量事件卡住
+            for (int32_t lane = 0; lane < TASK_PRIORITY_COUNT; ++lane) {
+                for (size_t begin = 0; begin < pending[lane].size(); begin += batchSize_) {
+                    size_t     end = std::min(pending[lane].size(), begin + batchSize_);
+                    EventBatch batch(this, lane);
+                    std::move(pending[lane].begin() + begin, pending[lane].begin() + end,
+                              std::back_inserter(batch.node->value));
+                    // 失败(拒绝/超时)的批次随batch析构计入lostEvents
+                    PushTask(std::move(batch), static_cast<TaskPriority>(lane));
+                }
+                pending[lane].clear();
             }
         }
     }
 
 private:
-    std::mutex                   mutex_;
-    std::thread                  eventThread_;
-    std::condition_variable      hasEvent_;
-    std::queue<std::string>      events_;
-    std::unique_ptr<std::thread> eventLoop_ = nullptr;
+    ProfiledMutex               mutex_{"EventManager::mutex_"};
+    std::thread                 eventThread_;
+    std::condition_variable_any hasEvent_;
+    EventVector                 events_[TASK_PRIORITY_COUNT];
+    size_t                      queuedEvents_ = 0; // events_中的事件总数
+    int32_t                     batchSize_    = EVENT_BATCH_SIZE;
+    std::unique_ptr<Strand[]>   strands_;
+    Handler                     handlers_[EVENT_ID_MAX];
 };
 
 EventManager* emgr = nullptr;
 
-void Test()
+const uint32_t EVENT_ID_SEQ = 1; // SeqEvent
+
+int32_t        eventCount  = 1e7; // 每个生产线程推送的事件数
+OverloadPolicy policy      = OverloadPolicy::POLICY_BLOCK;
+int32_t        urgentEvery = 0;     // 非0时test1推送BULK事件，test2每urgentEvery个推一个URGENT，其余为NORMAL
+int32_t        keyCount    = 0;     // 非0时每个生产线程按i % keyCount作key推送SeqEvent，两个线程的key不重叠
+bool           typedEvent  = false; // 不带key时推送SeqEvent而不是字符串
+
+void Test(bool bulk)
 {
-    for (int i = 0; i < 1e7; ++i) {
-        emgr->PushEvent(std::to_string(i));
+    for (int i = 0; i < eventCount; ++i) {
+        if (keyCount > 0) {
+            uint64_t key = (bulk ? 0 : keyCount) + i % keyCount;
+            emgr->PushEvent(key, Event(EVENT_ID_SEQ, SeqEvent{key, i}));
+            continue;
+        }
+        TaskPriority priority = TaskPriority::PRIORITY_NORMAL;
+        if (urgentEvery > 0 && bulk) {
+            priority = TaskPriority::PRIORITY_BULK;
+        } else if (urgentEvery > 0 && i % urgentEvery == 0) {
+            priority = TaskPriority::PRIORITY_URGENT;
+        }
+        if (typedEvent) {
+            emgr->PushEvent(Event(EVENT_ID_SEQ, SeqEvent{UINT64_MAX, i}), priority);
+        } else {
+            emgr->PushEvent(std::to_string(i), priority);
+        }
     }
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    // ./taskpool [count] [block|reject|drop|caller] [timeout_us] [batch] [urgent_every] [keys] [string|typed]
+    //            [none|compact|scatter|numa|numa-rr|cpus:0,2,4-7]
+    if (argc > 1) {
+        eventCount = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        std::string name = argv[2];
+        if (name == "reject") {
+            policy = OverloadPolicy::POLICY_REJECT;
+        } else if (name == "drop") {
+            policy = OverloadPolicy::POLICY_DROP_OLDEST;
+        } else if (name == "caller") {
+            policy = OverloadPolicy::POLICY_CALLER_RUNS;
+        }
+    }
+    std::chrono::microseconds timeout(argc > 3 ? atoi(argv[3]) : 0);
+    if (argc > 5) {
+        urgentEvery = atoi(argv[5]);
+    }
+    if (argc > 6) {
+        keyCount = atoi(argv[6]);
+        keyLastSeq.assign(2 * keyCount, -1);
+    }
+    typedEvent = argc > 7 && std::string(argv[7]) == "typed";
     cout << "******enter for start\n" << flush;
     cin.get();
     emgr = new EventManager();
+    emgr->RegisterHandler<SeqEvent>(EVENT_ID_SEQ, &OnSeqEvent);
+    PlacementPolicy placement;
+    if (argc > 8 && ParsePlacement(argv[8], placement)) {
+        emgr->SetPlacement(placement);
+        CpuTopology::GetInstance().DumpJson(cout);
+    }
+    emgr->SetOverloadPolicy(policy, timeout);
+    if (argc > 4) {
+        emgr->SetEventBatch(atoi(argv[4]));
+    }
+    auto     begin  = std::chrono::steady_clock::now();
+    uint64_t allocs = allocCount.load(std::memory_order_relaxed);
     emgr->StartEventLoop();
-    std::thread t1(&Test);
-    std::thread t2(&Test);
+    std::thread t1(&Test, true);
+    std::thread t2(&Test, false);
 #ifdef __linux__
     pthread_setname_np(t1.native_handle(), "test1");
     pthread_setname_np(t2.native_handle(), "test2");
@@ -215,8 +1346,42 @@ int main()
     if (t2.joinable()) {
         t2.join();
     }
+    // 被拒绝/超时/挤掉的事件不会再执行
+    while (handledEvents.load(std::memory_order_relaxed) + lostEvents.load(std::memory_order_relaxed) <
+           2ull * eventCount) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    uint64_t handled = handledEvents.load(std::memory_order_relaxed);
+    allocs           = allocCount.load(std::memory_order_relaxed) - allocs;
+    // 结果用cout直接输出，先把日志刷完免得交错
+    AsyncLog::GetInstance().Flush();
+    cout << "******events: " << handled << "/" << 2ull * eventCount << " handled, cost " << seconds << "s, "
+         << static_cast<uint64_t>(handled / seconds) << " events/s, "
+         << static_cast<double>(allocs) / (2ull * eventCount) << " allocs/event, "
+         << AsyncLog::GetInstance().Dropped() << " log lines dropped\n";
+    static const char* laneNames[TASK_PRIORITY_COUNT] = {"urgent", "normal", "bulk"};
+    for (int32_t i = 0; i < TASK_PRIORITY_COUNT; ++i) {
+        if (HistPercentile(eventLatencyHist[i], 1.0) == 0) {
+            continue;
+        }
+        cout << "******" << laneNames[i] << " latency p50 <= " << HistPercentile(eventLatencyHist[i], 0.5)
+             << "ns, p99 <= " << HistPercentile(eventLatencyHist[i], 0.99) << "ns\n";
+    }
+    if (keyCount > 0) {
+        cout << "******keyed: " << 2 * keyCount << " keys, "
+             << orderViolations.load(std::memory_order_relaxed) << " out of order, latency p50 <= "
+             << HistPercentile(keyedLatencyHist, 0.5) << "ns, p99 <= " << HistPercentile(keyedLatencyHist, 0.99)
+             << "ns\n";
+    }
+    cout << flush;
     cout << "******run done, entor for exit\n" << flush;
+    emgr->DumpOverloadStats(cout);
+    emgr->DumpLaneStats(cout);
+    LockProfiler::GetInstance().DumpJson(cout);
     cin.get();
+    emgr->StopEventLoop();
+    delete emgr;
     // vector<uint8_t> vec{1, 2, 3};
     // const char* p = reinterpret_cast<const char*>(vec.data());
     // cout << *p;
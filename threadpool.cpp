@@ -1,64 +1,176 @@
 // thread pool in c++11
 // use packaged_task && future && function && thread && forward && template && etc..
+#define BENCH_COUNT_ALLOCS // 统计每个任务的堆分配次数
+#include "async_log.h"
+#include "bench_util.h"
+#include "cpu_affinity.h"
+#include "lock_profiler.h"
+#include "task_function.h"
+#include "task_future.h"
 #include <atomic>
+#include <cerrno>
+#include <climits>
 #include <condition_variable>
 #include <functional>
 #include <future>
 #include <iostream>
+#include <linux/futex.h>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <thread>
+#include <unistd.h>
 #include <unordered_map>
 #include <vector>
 
-const int TASK_MAX_THRESHOLD   = INT32_MAX;
-const int THREAD_MAX_THRESHOLD = 1024;
-const int THREAD_MAX_IDLE_TIME = 60;
+const int    TASK_MAX_THRESHOLD   = INT32_MAX;
+const int    THREAD_MAX_THRESHOLD = 1024;
+const int    THREAD_MAX_IDLE_TIME = 60;
+const size_t TASK_RING_SIZE       = 4096; // 每个节点无锁环的容量，必须是2的幂
+const int    SCALE_INTERVAL_MS    = 10;   // cached模式扩缩容的采样周期
+const int    STATS_FLUSH_COUNT    = 64;   // 工作线程攒够这么多任务的统计再合并到全局计数
+const int    WORKER_SPIN_COUNT    = 256;  // 空闲线程睡眠前自旋检查的次数
+const int    WORKER_YIELD_COUNT   = 16;   // 自旋之后再让出cpu检查的次数，和提交者共用cpu时让它先攒一批任务
 
 enum class PoolMode {
     MODE_FIXED,  // 运行时不可修改
     MODE_CACHED, // 小而快的任务，任务处理比较紧急的情况，可以增加新的线程
 };
 
+enum class ShutdownMode {
+    SHUTDOWN_DRAIN,  // 执行完已排队的任务，超过期限后剩余的取消
+    SHUTDOWN_CANCEL, // 直接取消已排队的任务
+};
+
+const std::chrono::milliseconds SHUTDOWN_NO_DEADLINE = std::chrono::milliseconds::max();
+
+// cached模式的扩缩容：排队等待连续超过growWait且没有空闲线程时扩容，上次扩容后吞吐没有增长(CPU已饱和)则不再扩；
+// 等待回落到shrinkWait以下才允许空闲线程退出，两者之间保持不变，避免来回抖动
+struct ScalePolicy {
+    std::chrono::microseconds growWait{1000};
+    std::chrono::microseconds shrinkWait{100};
+    int32_t                   growTicks = 2;                            // 连续多少个采样周期超过才扩容
+    std::chrono::milliseconds idleTimeout{THREAD_MAX_IDLE_TIME * 1000}; // 扩出来的线程空闲这么久退出
+};
+
+// 线程由池持有，退出后由池join，不再detach
 class Thread {
 public:
     using ThreadFunc = std::function<void(int)>;
 
     Thread(ThreadFunc func) : func_(func), threadId_(generateId_++) {}
-    ~Thread() = default;
+    ~Thread() { Join(); }
+
+    void Start() { thread_ = std::thread(func_, threadId_); }
 
-    void Start()
+    void Join()
     {
-        std::thread t(func_, threadId_);
-        t.detach();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
     }
 
     int32_t GetId() const { return threadId_; }
 
 private:
-    ThreadFunc     func_; // 执行func的线程对象，与一个自定义的threadId绑定
-    static int32_t generateId_;
-    int32_t        threadId_;
+    ThreadFunc                  func_; // 执行func的线程对象，与一个自定义的threadId绑定
+    static std::atomic<int32_t> generateId_;
+    int32_t                     threadId_;
+    std::thread                 thread_;
+};
+std::atomic<int32_t> Thread::generateId_(0);
+
+// 有界MPMC环(Vyukov)：每个槽位带序号，生产者和消费者各自CAS抢位置，互不加锁；满/空时返回false由调用者处理
+class TaskRing {
+    using Task = TaskFunction<void()>;
+
+public:
+    explicit TaskRing(size_t capacity) : mask_(capacity - 1), slots_(new Slot[capacity])
+    {
+        for (size_t i = 0; i < capacity; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // 成功时task被移走
+    bool TryPush(Task& task, int64_t enqueueNs)
+    {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Slot*  slot;
+        while (true) {
+            slot          = &slots_[pos & mask_];
+            intptr_t diff = (intptr_t)slot->seq.load(std::memory_order_acquire) - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->task      = std::move(task);
+        slot->enqueueNs = enqueueNs;
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPop(Task& task, int64_t& enqueueNs)
+    {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Slot*  slot;
+        while (true) {
+            slot          = &slots_[pos & mask_];
+            intptr_t diff = (intptr_t)slot->seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        task      = std::move(slot->task);
+        enqueueNs = slot->enqueueNs;
+        slot->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> seq;
+        Task                task;
+        int64_t             enqueueNs; // 仅cached模式记录，用于统计排队等待
+    };
+
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    const size_t            mask_;
+    std::unique_ptr<Slot[]> slots_;
 };
-int32_t Thread::generateId_ = 0;
 
-class ThreadPool {
+class ThreadPool : public Executor {
+    using Task = TaskFunction<void()>;
+    struct QueuedTask {
+        Task    fn;
+        int64_t enqueueNs = 0;
+    };
+    using TaskNode = NodePool<QueuedTask>::Node;
+
 public:
     ThreadPool()
         : initThreadSize_(4), taskSize_(0), idleThreadSize_(0), curThreadSize_(0),
           taskQueueMaxThreshold_(TASK_MAX_THRESHOLD), threadSizeThreshold_(THREAD_MAX_THRESHOLD),
           poolMode_(PoolMode::MODE_FIXED), isPoolRunning_(false)
     {
+        queues_.push_back(std::make_unique<NodeQueue>());
     }
 
-    ~ThreadPool()
-    {
-        isPoolRunning_.store(false);
-        std::unique_lock<std::mutex> lock(taskQueueMutex_);
-        notEmpty_.notify_all();
-        exitCond_.wait(lock, [&]() -> bool { return threads_.size() == 0; });
-    }
+    ~ThreadPool() { Shutdown(ShutdownMode::SHUTDOWN_DRAIN, SHUTDOWN_NO_DEADLINE); }
 
     void SetMode(PoolMode mode)
     {
@@ -76,6 +188,15 @@ public:
         taskQueueMaxThreshold_ = threshold;
     }
 
+    // 线程绑核/按NUMA节点分组以及线程名前缀，PLACEMENT_NUMA_NODES时每个节点一个任务队列
+    void SetPlacement(const PlacementPolicy& placement)
+    {
+        if (CheckRunningState()) {
+            return;
+        }
+        placement_ = placement;
+    }
+
     void SetThreadSizeThreshold(int32_t threshold)
     {
         if (CheckRunningState()) {
@@ -86,46 +207,59 @@ public:
         }
     }
 
+    // cached模式的扩缩容阈值和空闲线程的退出时间
+    void SetScalePolicy(const ScalePolicy& policy)
+    {
+        if (CheckRunningState()) {
+            return;
+        }
+        scalePolicy_ = policy;
+    }
+
+    int32_t GetThreadSize() const { return curThreadSize_; }
+
+    // 返回TaskFuture，可以Then()串接后续任务而不阻塞线程；任务和结果共用一块对象池内存，稳态下不分配堆内存
+    // 提交失败时future直接得到默认值
     template <typename Func, typename... Args>
-    auto SubmitTask(Func&& func, Args&&... args) -> void
+    auto SubmitTask(Func&& func, Args&&... args) -> TaskFuture<decltype(func(args...))>
     {
-        // 将函数func和参数args打包成 RetType()类型的函数
         using RetType = decltype(func(args...));
-        auto task     = std::make_shared<std::packaged_task<RetType()>>(
-            std::bind(std::forward<Func>(func), std::forward<Args>(args)...));
+        using Bound   = decltype(std::bind(std::forward<Func>(func), std::forward<Args>(args)...));
+        using State   = TaskState<RetType, Bound>;
+        StateRef<State> state(
+            NewFutureState<State>(this, std::bind(std::forward<Func>(func), std::forward<Args>(args)...)));
+        TaskFuture<RetType> result{StateRef<FutureState<RetType>>(state)};
+        Task                task(StateRunner<State>(std::move(state)));
+        EnqueueTask(task);
+        return result;
+    }
 
-        // std::future<RetType> result = task->get_future();
+    // Then()的后续任务：不受队列上限限制，避免工作线程阻塞在等自己腾位置上；线程池已停止时就地执行
+    void Execute(Task&& task) override
+    {
+        if (!isPoolRunning_ || !EnqueueTask(task, false)) {
+            task();
+        }
+    }
 
-        std::unique_lock<std::mutex> lock(taskQueueMutex_);
-        if (!notFull_.wait_for(lock, std::chrono::seconds(1),
-                               [&]() -> bool { return taskQueue_.size() < (size_t)taskQueueMaxThreshold_; })) {
-            std::cerr << "task queue is full, submit task failed" << std::endl /*std::flush*/;
+    // 需要std::future时使用，共享状态需要单独分配
+    template <typename Func, typename... Args>
+    auto SubmitTaskWithResult(Func&& func, Args&&... args) -> std::future<decltype(func(args...))>
+    {
+        // 将函数func和参数args打包成 RetType()类型的函数
+        using RetType = decltype(func(args...));
+        std::packaged_task<RetType()> task(std::bind(std::forward<Func>(func), std::forward<Args>(args)...));
+        std::future<RetType>          result = task.get_future();
+        // 将task进一步转化成void()类型的函数
+        Task wrapper([task = std::move(task)]() mutable { task(); });
+        if (!EnqueueTask(wrapper)) {
             // 任务池已满，到达最最大值，即达到了cached模式下的上限
             // 返回默认值
-            auto task = std::make_shared<std::packaged_task<RetType()>>([]() -> RetType { return RetType(); });
-            (*task)();
-            // return task->get_future();
-            return;
-        }
-        // 将task进一步转化成void()类型的函数
-        taskQueue_.emplace([task]() { (*task)(); });
-        ++taskSize_;
-        // 任务队列不空，唤醒线程执行
-        notEmpty_.notify_all();
-
-        if (poolMode_ == PoolMode::MODE_CACHED && taskSize_ > idleThreadSize_ &&
-            curThreadSize_ < threadSizeThreshold_) {
-            // cached模式下，且已无idle线程，且未达到threshold上限，新建线程用于处理小而快的任务
-            std::cout << ">>> create new thread..." << std::endl /*std::flush*/;
-
-            auto    ptr = std::make_unique<Thread>(std::bind(&ThreadPool::ThreadFunc, this, std::placeholders::_1));
-            int32_t threadId = ptr->GetId();
-            threads_.emplace(threadId, std::move(ptr));
-            threads_[threadId]->Start();
-            ++curThreadSize_;
-            ++idleThreadSize_;
+            std::packaged_task<RetType()> dummy([]() -> RetType { return RetType(); });
+            dummy();
+            return dummy.get_future();
         }
-        // return result;
+        return result;
     }
 
     void Start(int32_t initThreadSize = std::thread::hardware_concurrency())
@@ -133,19 +267,62 @@ public:
         isPoolRunning_.store(true);
 
         initThreadSize_ = initThreadSize;
-        curThreadSize_  = initThreadSize;
 
-        for (size_t i = 0; i < initThreadSize_; ++i) {
+        const CpuTopology& topology = CpuTopology::GetInstance();
+        if (placement_.mode == PlacementMode::PLACEMENT_NUMA_NODES && topology.NodeCount() > 1) {
+            nodeCount_ = std::min(topology.NodeCount(), std::max(initThreadSize, 1));
+        }
+        // Start前提交的任务都在0号队列里，保留
+        while ((int32_t)queues_.size() < nodeCount_) {
+            queues_.push_back(std::make_unique<NodeQueue>());
+        }
+
+        {
             // 建立初始化数量的线程
-            auto    ptr = std::make_unique<Thread>(std::bind(&ThreadPool::ThreadFunc, this, std::placeholders::_1));
-            int32_t threadId = ptr->GetId();
-            threads_.emplace(threadId, std::move(ptr));
+            std::lock_guard<ProfiledMutex> lock(taskQueueMutex_);
+            for (size_t i = 0; i < initThreadSize_; ++i) {
+                AddThreadLocked();
+            }
         }
+        if (poolMode_ == PoolMode::MODE_CACHED) {
+            monitor_ = std::thread(&ThreadPool::MonitorMain, this);
+        }
+    }
 
-        for (size_t i = 0; i < initThreadSize_; ++i) {
-            threads_[i]->Start();
-            ++idleThreadSize_;
+    // 停止接收新任务并回收所有线程：SHUTDOWN_DRAIN先执行已排队的任务，超过timeout后剩余的取消，
+    // SHUTDOWN_CANCEL直接取消；正在执行的任务总会执行完，被取消任务的future得到默认值；返回取消的任务数，重复调用返回0
+    size_t Shutdown(ShutdownMode mode, std::chrono::milliseconds timeout)
+    {
+        if (shutdown_.exchange(true)) {
+            return 0;
+        }
+        size_t cancelled = mode == ShutdownMode::SHUTDOWN_CANCEL ? CancelQueued() : 0;
+        isPoolRunning_.store(false);
+        NotifyAll();
+        {
+            std::unique_lock<ProfiledMutex> lock(taskQueueMutex_);
+            notFull_.notify_all();
+            auto allExited = [&]() -> bool { return curThreadSize_ == 0; };
+            if (timeout == SHUTDOWN_NO_DEADLINE) {
+                exitCond_.wait(lock, allExited);
+            } else if (!exitCond_.wait_for(lock, timeout, allExited)) {
+                // 到期：取消剩余的排队任务，只等正在执行的
+                lock.unlock();
+                cancelled += CancelQueued();
+                NotifyAll();
+                lock.lock();
+                exitCond_.wait(lock, allExited);
+            }
+        }
+        // 排空期间监控线程继续扩容，线程全部退出后才停
+        StopMonitor();
+        ReapExited();
+        // Start前提交的，或线程退出时刚好漏下的
+        cancelled += CancelQueued();
+        if (cancelled > 0) {
+            LOGW("shutdown cancelled %zu queued tasks", cancelled);
         }
+        return cancelled;
     }
 
     ThreadPool(const ThreadPool&)            = delete;
@@ -155,85 +332,403 @@ private:
     // 线程池线程执行体
     void ThreadFunc(int32_t threadId)
     {
-        auto lastTime = std::chrono::system_clock::now();
-
+        auto    lastTime = std::chrono::steady_clock::now();
+        int32_t index    = nextThreadIndex_++;
+        int32_t node     = 0;
+        if (BindCurrentThread(CpuTopology::GetInstance().CpusFor(placement_, index, node)) != 0) {
+            LOGW("threadId: %d bind cpu failed", threadId);
+        }
+        // 线程数少于节点数时CpusFor可能分到没有队列的节点
+        node %= nodeCount_;
+        SetThreadName(pthread_self(), (placement_.namePrefix.empty() ? "pool" : placement_.namePrefix) +
+                                          std::to_string(index));
+
+        bool     searched = false;
+        uint32_t picked   = 0; // 本地攒着的统计，空闲或攒够STATS_FLUSH_COUNT个时合并
+        int64_t  waitNs   = 0;
         while (true) {
-            Task task;
-            {
-                std::unique_lock<std::mutex> lock(taskQueueMutex_);
-                std::cout << "tid: " << std::this_thread::get_id() << ", try to get task..."
-                          << std::endl /*std::flush*/;
-                // 进到这里面说明，至少该线程是空闲的
-                while (taskQueue_.size() == 0) {
-                    if (!isPoolRunning_) {
-                        threads_.erase(threadId);
-                        std::cout << "threadId: " << std::this_thread::get_id() << " exit!" << std::endl /*std::flush*/;
-                        exitCond_.notify_all();
-                        return;
-                    }
-
-                    if (poolMode_ == PoolMode::MODE_CACHED) {
-                        if (std::cv_status::timeout == notEmpty_.wait_for(lock, std::chrono::seconds(1))) {
-                            auto now = std::chrono::system_clock::now();
-                            auto dur = std::chrono::duration_cast<std::chrono::seconds>(now - lastTime);
-                            if (dur.count() >= THREAD_MAX_IDLE_TIME && curThreadSize_ > initThreadSize_) {
-                                // cached模式下，若该线程是另创建新创建的线程，且60s内未接收新任务，则回收该新创建的线程
-                                threads_.erase(threadId);
-                                --curThreadSize_;
-                                --idleThreadSize_;
-                                std::cout << "threadId: " << std::this_thread::get_id() << " exit!" << std::endl
-                                    /*std::flush*/;
-                                return;
-                            }
-                        }
-                    } else {
-                        notEmpty_.wait(lock);
-                    }
+            Task    task;
+            int64_t enqueueNs = 0;
+            if (!PopTask(node, task, enqueueNs)) {
+                FlushStats(picked, waitNs);
+                if (!WaitForTask(threadId, lastTime)) {
+                    return;
                 }
-                --idleThreadSize_;
-                std::cout << "tid: " << std::this_thread::get_id() << ", get task successfully..." << std::endl
-                    /*std::flush*/;
-                // 拿任务，若仍有任务剩余，通知其他线程
-                task = taskQueue_.front();
-                taskQueue_.pop();
-                --taskSize_;
-
-                if (taskQueue_.size() > 0) {
-                    notEmpty_.notify_all();
-                }
-
-                notFull_.notify_all();
+                searched = true;
+                continue;
+            }
+            LOGD("get task successfully...");
+            --idleThreadSize_;
+            --taskSize_;
+            if (enqueueNs != 0) {
+                waitNs += (int64_t)LockProfiler::NowNs() - enqueueNs;
+            }
+            if (++picked >= STATS_FLUSH_COUNT) {
+                FlushStats(picked, waitNs);
+            }
+            // 空闲后找到任务的线程负责再叫醒一个，忙碌时逐个拉起线程，而不是每个任务都唤醒
+            if (searched && taskSize_ > 0) {
+                NotifyOne();
+            }
+            searched = false;
+            // 只在确实有提交者阻塞时才加锁，且只唤醒一个：取走一个任务只腾出一个位置
+            if (pushWaiters_.load() > 0) {
+                std::lock_guard<ProfiledMutex> lock(taskQueueMutex_);
+                notFull_.notify_one();
             }
 
             if (task) {
                 task();
             }
             ++idleThreadSize_;
-            lastTime = std::chrono::system_clock::now();
+            lastTime = std::chrono::steady_clock::now();
+        }
+    }
+
+    void FlushStats(uint32_t& picked, int64_t& waitNs)
+    {
+        if (picked > 0) {
+            pickedTasks_.fetch_add(picked, std::memory_order_relaxed);
+            waitSumNs_.fetch_add(waitNs, std::memory_order_relaxed);
+            picked = 0;
+            waitNs = 0;
         }
     }
 
     bool CheckRunningState() const { return isPoolRunning_; }
 
+    // 先取本节点的环，再取其他节点的，最后才加锁取溢出链表
+    bool PopTask(int32_t home, Task& task, int64_t& enqueueNs)
+    {
+        for (int32_t i = 0; i < nodeCount_; ++i) {
+            if (queues_[(home + i) % nodeCount_]->ring.TryPop(task, enqueueNs)) {
+                return true;
+            }
+        }
+        if (overflowSize_.load(std::memory_order_acquire) == 0) {
+            return false;
+        }
+        std::lock_guard<ProfiledMutex> lock(taskQueueMutex_);
+        for (int32_t i = 0; i < nodeCount_; ++i) {
+            NodeQueue& queue = *queues_[(home + i) % nodeCount_];
+            if (queue.head == nullptr) {
+                continue;
+            }
+            TaskNode* node = queue.head;
+            queue.head     = node->next;
+            if (queue.head == nullptr) {
+                queue.tail = nullptr;
+            }
+            task      = std::move(node->value.fn);
+            enqueueNs = node->value.enqueueNs;
+            NodePool<QueuedTask>::Release(node);
+            --overflowSize_;
+            return true;
+        }
+        return false;
+    }
+
+    // 空闲时先自旋，再睡在wakeEpoch_上；返回false表示本线程应退出
+    bool WaitForTask(int32_t threadId, std::chrono::steady_clock::time_point lastTime)
+    {
+        ++spinning_;
+        for (int i = 0; i < WORKER_SPIN_COUNT + WORKER_YIELD_COUNT; ++i) {
+            if (taskSize_.load(std::memory_order_relaxed) > 0) {
+                --spinning_;
+                return true;
+            }
+            if (i < WORKER_SPIN_COUNT) {
+                cpuRelax();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        // 先取epoch再登记：登记之后的唤醒都会改变epoch，futex不会睡过头
+        uint32_t epoch = wakeEpoch_.load(std::memory_order_acquire);
+        sleepers_.fetch_add(1);
+        --spinning_;
+        // 与NotifyOne/NotifyAll中的fence配对：要么这里看到新任务/停止，要么提交方看到有线程在自旋或睡眠
+        if (taskSize_.load() > 0) {
+            --sleepers_;
+            return true;
+        }
+        if (!isPoolRunning_) {
+            --sleepers_;
+            std::lock_guard<ProfiledMutex> lock(taskQueueMutex_);
+            RetireLocked(threadId);
+            return false;
+        }
+        // 只在真正睡眠前打日志，自旋/伪唤醒的路径上不打，免得日志本身干扰唤醒路径
+        LOGD("threadId: %d no task, sleep", threadId);
+        // cached模式下定时醒来检查空闲时间，最长1s
+        auto     idleTimeout = std::min<std::chrono::milliseconds>(scalePolicy_.idleTimeout, std::chrono::seconds(1));
+        timespec timeout     = {idleTimeout.count() / 1000, idleTimeout.count() % 1000 * 1000000};
+        long     ret         = syscall(SYS_futex, reinterpret_cast<uint32_t*>(&wakeEpoch_), FUTEX_WAIT_PRIVATE, epoch,
+                                       poolMode_ == PoolMode::MODE_CACHED ? &timeout : nullptr, nullptr, 0);
+        int      err         = errno;
+        --sleepers_;
+        if (ret != 0 && err == ETIMEDOUT && std::chrono::steady_clock::now() - lastTime >= scalePolicy_.idleTimeout &&
+            recentWaitNs_.load(std::memory_order_relaxed) < NanosOf(scalePolicy_.shrinkWait)) {
+            // cached模式下，扩出来的线程空闲超时且排队压力已经消失，回收该线程
+            // 加锁后再检查，多个线程同时超时也不会缩到初始数量以下
+            std::lock_guard<ProfiledMutex> lock(taskQueueMutex_);
+            if (curThreadSize_ > initThreadSize_) {
+                RetireLocked(threadId);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 持锁调用：线程退出前登记，由监控线程或Shutdown负责join，线程不再删除自己的Thread对象
+    void RetireLocked(int32_t threadId)
+    {
+        exited_.push_back(threadId);
+        --curThreadSize_;
+        --idleThreadSize_;
+        LOGI("threadId: %d exit!", threadId);
+        exitCond_.notify_all();
+    }
+
+    // 锁内摘下已退出的线程，锁外join
+    void ReapExited()
+    {
+        std::vector<std::unique_ptr<Thread>> done;
+        {
+            std::lock_guard<ProfiledMutex> lock(taskQueueMutex_);
+            for (int32_t threadId : exited_) {
+                auto it = threads_.find(threadId);
+                done.push_back(std::move(it->second));
+                threads_.erase(it);
+            }
+            exited_.clear();
+        }
+        for (auto& thread : done) {
+            thread->Join();
+        }
+    }
+
+    // 持锁调用
+    void AddThreadLocked()
+    {
+        auto    ptr    = std::make_unique<Thread>(std::bind(&ThreadPool::ThreadFunc, this, std::placeholders::_1));
+        Thread* thread = ptr.get();
+        threads_.emplace(thread->GetId(), std::move(ptr));
+        ++curThreadSize_;
+        ++idleThreadSize_;
+        thread->Start();
+    }
+
+    // 取出所有排队的任务并在锁外丢弃，future得到默认值，其后续任务就地执行
+    size_t CancelQueued()
+    {
+        size_t  count = 0;
+        Task    task;
+        int64_t enqueueNs;
+        while (PopTask(0, task, enqueueNs)) {
+            --taskSize_;
+            task.Reset();
+            ++count;
+        }
+        return count;
+    }
+
+    template <class Duration> static int64_t NanosOf(Duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    }
+
+    // cached模式的监控线程：定期做扩容决策并join已退出的线程
+    void MonitorMain()
+    {
+        SetThreadName(pthread_self(), (placement_.namePrefix.empty() ? "pool" : placement_.namePrefix) + "-mon");
+        std::unique_lock<std::mutex> lock(monitorMutex_);
+        while (!monitorCond_.wait_for(lock, std::chrono::milliseconds(SCALE_INTERVAL_MS),
+                                      [&]() -> bool { return monitorStop_; })) {
+            lock.unlock();
+            ScaleOnce();
+            ReapExited();
+            lock.lock();
+        }
+    }
+
+    void StopMonitor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(monitorMutex_);
+            monitorStop_ = true;
+        }
+        monitorCond_.notify_all();
+        if (monitor_.joinable()) {
+            monitor_.join();
+        }
+    }
+
+    // 等待取本周期取出任务的平均排队时间与按积压/吞吐(Little定律)推算值中的较大者；
+    // 有积压却一个都没取走(任务都阻塞住了)时推算值视为无穷大
+    void ScaleOnce()
+    {
+        uint64_t picked    = pickedTasks_.load(std::memory_order_relaxed);
+        uint64_t waitSum   = waitSumNs_.load(std::memory_order_relaxed);
+        uint64_t newPicked = picked - lastPicked_;
+        int64_t  avgWait   = newPicked > 0 ? (int64_t)((waitSum - lastWaitSum_) / newPicked) : 0;
+        lastPicked_        = picked;
+        lastWaitSum_       = waitSum;
+
+        double  throughput = newPicked * 1000.0 / SCALE_INTERVAL_MS;
+        int32_t backlog    = taskSize_.load();
+        int64_t estimate   = backlog <= 0 ? 0 : newPicked > 0 ? (int64_t)(backlog * 1e9 / throughput) : INT64_MAX;
+        int64_t wait       = std::max(avgWait, estimate);
+        recentWaitNs_.store(wait, std::memory_order_relaxed);
+
+        if (wait < NanosOf(scalePolicy_.shrinkWait)) {
+            // 压力消失，下次重新按等待时间扩容
+            growStreak_   = 0;
+            growBaseline_ = -1;
+            return;
+        }
+        if (wait <= NanosOf(scalePolicy_.growWait) || idleThreadSize_ > 0 || backlog <= 0) {
+            growStreak_ = 0;
+            return;
+        }
+        if (++growStreak_ < scalePolicy_.growTicks) {
+            return;
+        }
+        growStreak_ = 0;
+        // 上次扩容后吞吐没有明显增长，瓶颈在CPU而不在线程数，继续加线程只会增加切换
+        if (growBaseline_ >= 0 && newPicked > 0 && throughput < growBaseline_ * 1.1) {
+            return;
+        }
+        growBaseline_ = throughput;
+        std::lock_guard<ProfiledMutex> lock(taskQueueMutex_);
+        int32_t step = std::min(std::max(curThreadSize_ / 4, 1), threadSizeThreshold_ - curThreadSize_);
+        // 关闭时线程已全部退出就不能再加，否则Shutdown等不到新线程
+        if (step <= 0 || (!isPoolRunning_ && curThreadSize_ == 0)) {
+            return;
+        }
+        for (int32_t i = 0; i < step; ++i) {
+            AddThreadLocked();
+        }
+        // wait为-1表示积压没有被取走
+        LOGI(">>> create %d new threads, wait %lld us, %.0f tasks/s", step,
+             (long long)(wait == INT64_MAX ? -1 : wait / 1000), throughput);
+    }
+
+    // 只唤醒一个，不让所有空闲线程一起醒来抢同一个任务；已有线程在自旋找任务或没人睡着时不发起系统调用
+    void NotifyOne()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (spinning_.load(std::memory_order_relaxed) > 0 || sleepers_.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        wakeEpoch_.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&wakeEpoch_), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+    void NotifyAll()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        wakeEpoch_.fetch_add(1, std::memory_order_release);
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&wakeEpoch_), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    // 队列满时的阻塞回退，最多等1s
+    bool WaitNotFull()
+    {
+        std::unique_lock<ProfiledMutex> lock(taskQueueMutex_);
+        ++pushWaiters_;
+        bool ok = notFull_.wait_for(lock, std::chrono::seconds(1),
+                                    [&]() -> bool { return shutdown_ || taskSize_ < taskQueueMaxThreshold_; });
+        --pushWaiters_;
+        return ok;
+    }
+
+    // 入队成功返回true，失败时task保持原样；bounded为false时不检查队列上限
+    // 上限是近似的，并发提交时最多超出提交线程数个
+    bool EnqueueTask(Task& task, bool bounded = true)
+    {
+        if (shutdown_.load(std::memory_order_relaxed)) {
+            LOGW_RATE(10, "thread pool is shut down, submit task failed");
+            return false;
+        }
+        if (bounded && taskSize_.load(std::memory_order_relaxed) >= taskQueueMaxThreshold_ && !WaitNotFull()) {
+            LOGW_RATE(10, "task queue is full, submit task failed");
+            return false;
+        }
+        NodeQueue& queue     = *queues_[SubmitNodeFor(placement_, nodeCount_, nextNode_)];
+        int64_t    enqueueNs = poolMode_ == PoolMode::MODE_CACHED ? (int64_t)LockProfiler::NowNs() : 0;
+        // 溢出链表不空时也进链表，保持先进先出
+        if (overflowSize_.load(std::memory_order_acquire) > 0 || !queue.ring.TryPush(task, enqueueNs)) {
+            std::lock_guard<ProfiledMutex> lock(taskQueueMutex_);
+            TaskNode*                      node = NodePool<QueuedTask>::Acquire();
+            node->value.fn                      = std::move(task);
+            node->value.enqueueNs               = enqueueNs;
+            if (queue.tail == nullptr) {
+                queue.head = node;
+            } else {
+                queue.tail->next = node;
+            }
+            queue.tail = node;
+            ++overflowSize_;
+        }
+        ++taskSize_;
+        // 任务队列不空，唤醒一个线程执行；cached模式下是否新建线程由监控线程按排队等待决定
+        NotifyOne();
+        return true;
+    }
+
     std::unordered_map<int32_t, std::unique_ptr<Thread>> threads_;
+    std::vector<int32_t>                                 exited_; // 已退出待join的线程，taskQueueMutex_保护
 
     size_t              initThreadSize_;
     int32_t             threadSizeThreshold_;
     std::atomic_int32_t curThreadSize_;
     std::atomic_int32_t idleThreadSize_;
 
-    using Task = std::function<void()>;
-    std::queue<Task>    taskQueue_;
-    std::atomic_int32_t taskSize_;
-    int32_t             taskQueueMaxThreshold_;
-
-    std::mutex              taskQueueMutex_;
-    std::condition_variable notFull_;
-    std::condition_variable notEmpty_;
-    std::condition_variable exitCond_;
+    // 每个NUMA节点一个无锁环，提交和取任务都不加锁；环满时进加锁的溢出链表(对象池节点，稳态不分配内存)
+    struct NodeQueue {
+        TaskRing  ring{TASK_RING_SIZE};
+        TaskNode* head = nullptr; // 溢出链表，taskQueueMutex_保护
+        TaskNode* tail = nullptr;
+    };
+    std::vector<std::unique_ptr<NodeQueue>> queues_;
+    std::atomic_int32_t                     taskSize_; // 提交后才计数，可能短暂小于实际任务数
+    std::atomic_int32_t                     overflowSize_{0};
+    int32_t                                 taskQueueMaxThreshold_;
+
+    PlacementPolicy       placement_;
+    int32_t               nodeCount_ = 1;
+    std::atomic<uint32_t> nextNode_{0};        // 不按节点提交时轮流分配
+    std::atomic<int32_t>  nextThreadIndex_{0}; // 按启动顺序给线程编号，决定绑定的CPU和所属节点
+
+    // 空闲线程先自旋再睡在wakeEpoch_上(futex)，提交时没人自旋且有人睡着才唤醒一个
+    std::atomic<uint32_t> wakeEpoch_{0};
+    std::atomic<int32_t>  spinning_{0};
+    std::atomic<int32_t>  sleepers_{0};
+    std::atomic<int32_t>  pushWaiters_{0}; // 阻塞在notFull_上的提交者
+
+    // cached模式扩缩容：工作线程合并的统计，以及只由监控线程读写的决策状态
+    ScalePolicy             scalePolicy_;
+    std::thread             monitor_;
+    std::mutex              monitorMutex_;
+    std::condition_variable monitorCond_;
+    bool                    monitorStop_ = false;
+    std::atomic<uint64_t>   pickedTasks_{0};
+    std::atomic<uint64_t>   waitSumNs_{0};
+    std::atomic<int64_t>    recentWaitNs_{0}; // 最近一个周期的等待估计，空闲线程据此决定能否退出
+    uint64_t                lastPicked_   = 0;
+    uint64_t                lastWaitSum_  = 0;
+    int32_t                 growStreak_   = 0;
+    double                  growBaseline_ = -1; // 上次扩容时的吞吐，-1表示没有在扩容中
+
+    // 只保护溢出链表、threads_和阻塞提交，不在提交/取任务的常规路径上
+    ProfiledMutex               taskQueueMutex_{"ThreadPool::taskQueueMutex_"};
+    std::condition_variable_any notFull_;
+    std::condition_variable_any exitCond_;
 
     PoolMode         poolMode_;
     std::atomic_bool isPoolRunning_;
+    std::atomic_bool shutdown_{false};
 };
 
 int sum1(int a, int b)
@@ -252,9 +747,9 @@ int sum2(int a, int b, int c)
 // {
 //     ThreadPool pool;
 //     pool.Start(4);
-//     std::future<int> r1 = pool.SubmitTask(sum1, 10, 20);
-//     std::future<int> r2 = pool.SubmitTask(sum2, 10, 20, 30);
-//     std::future<int> r3 = pool.SubmitTask(
+//     TaskFuture<int> r1 = pool.SubmitTask(sum1, 10, 20);
+//     TaskFuture<int> r2 = pool.SubmitTask(sum2, 10, 20, 30);
+//     TaskFuture<int> r3 = pool.SubmitTask(
 //         [](int b, int e) -> int {
 //             int sum = 0;
 //             for (int i = b; i < e; ++i)
@@ -263,9 +758,9 @@ int sum2(int a, int b, int c)
 //         },
 //         1, 1e8);
 
-//     std::cout << r1.get() << std::endl /*std::flush*/;
-//     std::cout << r2.get() << std::endl /*std::flush*/;
-//     std::cout << r3.get() << std::endl /*std::flush*/;
+//     std::cout << r1.Get() << std::endl /*std::flush*/;
+//     std::cout << r2.Get() << std::endl /*std::flush*/;
+//     std::cout << r3.Get() << std::endl /*std::flush*/;
 // }
 
 // void test2()
@@ -273,9 +768,9 @@ int sum2(int a, int b, int c)
 //     ThreadPool pool;
 //     pool.SetMode(PoolMode::MODE_CACHED);
 //     pool.Start(2);
-//     std::future<int> r1 = pool.SubmitTask(sum1, 10, 20);
-//     std::future<int> r2 = pool.SubmitTask(sum2, 10, 20, 30);
-//     std::future<int> r3 = pool.SubmitTask(
+//     TaskFuture<int> r1 = pool.SubmitTask(sum1, 10, 20);
+//     TaskFuture<int> r2 = pool.SubmitTask(sum2, 10, 20, 30);
+//     TaskFuture<int> r3 = pool.SubmitTask(
 //         [](int b, int e) -> int {
 //             int sum = 0;
 //             for (int i = b; i < e; ++i)
@@ -284,9 +779,9 @@ int sum2(int a, int b, int c)
 //         },
 //         1, 1e8);
 
-//     std::cout << r1.get() << std::endl /*std::flush*/;
-//     std::cout << r2.get() << std::endl /*std::flush*/;
-//     std::cout << r3.get() << std::endl /*std::flush*/;
+//     std::cout << r1.Get() << std::endl /*std::flush*/;
+//     std::cout << r2.Get() << std::endl /*std::flush*/;
+//     std::cout << r3.Get() << std::endl /*std::flush*/;
 // }
 
 void test3()
@@ -334,34 +829,190 @@ void test3()
             return sum;
         },
         1, 100);
-    // std::future<int> r6 = pool.SubmitTask(sum1, 10, 20);
-    // std::future<int> r7 = pool.SubmitTask(sum1, 10, 20);
-    // std::future<int> r8 = pool.SubmitTask(sum1, 10, 20);
-    // std::future<int> r9 = pool.SubmitTask(sum1, 10, 20);
-    // std::future<int> r10 = pool.SubmitTask(sum1, 10, 20);
+    // TaskFuture<int> r6 = pool.SubmitTask(sum1, 10, 20);
+    // TaskFuture<int> r7 = pool.SubmitTask(sum1, 10, 20);
+    // TaskFuture<int> r8 = pool.SubmitTask(sum1, 10, 20);
+    // TaskFuture<int> r9 = pool.SubmitTask(sum1, 10, 20);
+    // TaskFuture<int> r10 = pool.SubmitTask(sum1, 10, 20);
     pool.SubmitTask(sum1, 10, 20);
     pool.SubmitTask(sum1, 10, 20);
     pool.SubmitTask(sum1, 10, 20);
     pool.SubmitTask(sum1, 10, 20);
     pool.SubmitTask(sum1, 10, 20);
-    // std::cout << r1.get() << std::endl /*std::flush*/;
-    // std::cout << r2.get() << std::endl /*std::flush*/;
-    // std::cout << r3.get() << std::endl /*std::flush*/;
-    // std::cout << r4.get() << std::endl /*std::flush*/;
-    // std::cout << r5.get() << std::endl /*std::flush*/;
-    // std::cout << r6.get() << std::endl /*std::flush*/;
-    // std::cout << r7.get() << std::endl /*std::flush*/;
-    // std::cout << r8.get() << std::endl /*std::flush*/;
-    // std::cout << r9.get() << std::endl /*std::flush*/;
-    // std::cout << r10.get() << std::endl /*std::flush*/;
+    // std::cout << r1.Get() << std::endl /*std::flush*/;
+    // std::cout << r2.Get() << std::endl /*std::flush*/;
+    // std::cout << r3.Get() << std::endl /*std::flush*/;
+    // std::cout << r4.Get() << std::endl /*std::flush*/;
+    // std::cout << r5.Get() << std::endl /*std::flush*/;
+    // std::cout << r6.Get() << std::endl /*std::flush*/;
+    // std::cout << r7.Get() << std::endl /*std::flush*/;
+    // std::cout << r8.Get() << std::endl /*std::flush*/;
+    // std::cout << r9.Get() << std::endl /*std::flush*/;
+    // std::cout << r10.Get() << std::endl /*std::flush*/;
+}
+
+// 大量小任务，统计提交路径上每个任务的堆分配次数
+void test4(int32_t count, const PlacementPolicy& placement)
+{
+    ThreadPool           pool;
+    std::atomic<int64_t> sum(0);
+    pool.SetPlacement(placement);
+    // 限制队列深度，否则提交快于执行时队列无限增长，节点总得新分配
+    pool.SetTaskQueueMaxThreshold(1024);
+    pool.Start(2);
+    // 先跑一轮预热对象池，等执行完节点都回到池里
+    std::atomic<int32_t> done(0);
+    for (int32_t i = 0; i < count; ++i) {
+        pool.SubmitTask([&sum, &done](int32_t v) {
+            sum += v;
+            ++done;
+        }, i);
+    }
+    while (done < count) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    uint64_t allocs = allocCount.load();
+    for (int32_t i = 0; i < count; ++i) {
+        pool.SubmitTask([&sum](int32_t v) { sum += v; }, i);
+    }
+    allocs = allocCount.load() - allocs;
+    std::future<int> result = pool.SubmitTaskWithResult(sum1, 1, 2);
+    result.wait();
+    AsyncLog::GetInstance().Flush();
+    std::cout << "sum: " << sum << ", result: " << result.get() << ", " << (double)allocs / count
+              << " allocs/task" << std::endl;
+}
+
+// 串接与组合：Then的后续任务回到线程池执行，WhenAll/WhenAny不占用等待线程
+void test5()
+{
+    ThreadPool pool;
+    pool.Start(4);
+    TaskFuture<int> chained = pool.SubmitTask(sum1, 10, 20).Then([](int v) { return v * 2; }).Then([](int v) {
+        LOGI("chained result: %d", v);
+        return v + 1;
+    });
+
+    std::vector<TaskFuture<int>> parts;
+    for (int i = 1; i <= 4; ++i) {
+        parts.push_back(pool.SubmitTask([](int v) { return v * v; }, i));
+    }
+    TaskFuture<int> total = WhenAll(std::move(parts)).Then([](std::vector<int> values) {
+        int sum = 0;
+        for (int v : values) {
+            sum += v;
+        }
+        return sum;
+    });
+
+    std::vector<TaskFuture<int>> racers;
+    racers.push_back(pool.SubmitTask(sum2, 1, 2, 3));
+    racers.push_back(pool.SubmitTask([]() { return 42; }));
+    std::pair<size_t, int> first = WhenAny(std::move(racers)).Get();
+
+    std::vector<TaskFuture<void>> waits;
+    for (int i = 0; i < 3; ++i) {
+        waits.push_back(pool.SubmitTask([]() { std::this_thread::sleep_for(std::chrono::milliseconds(10)); }));
+    }
+    WhenAll(std::move(waits)).Then([]() { LOGI("all void tasks done"); }).Wait();
+
+    std::cout << "then: " << chained.Get() << ", when_all: " << total.Get() << ", when_any: #" << first.first
+              << " = " << first.second << std::endl;
+}
+
+// test3的负载(cached模式、2个初始线程)放大成count个小任务，用getrusage统计每个任务的上下文切换次数
+// 测的是唤醒路径，关掉调试日志，避免后台写日志的线程和写满丢弃影响cs/task与吞吐
+void test6(int32_t count)
+{
+    AsyncLog::SetLevel(LOG_LEVEL_INFO);
+    std::atomic<int64_t> sum(0);
+    std::atomic<int32_t> done(0);
+    int32_t              threads = 0;
+    rusage               before;
+    getrusage(RUSAGE_SELF, &before);
+    auto begin = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool;
+        pool.SetMode(PoolMode::MODE_CACHED);
+        pool.Start(2);
+        for (int32_t i = 0; i < count; ++i) {
+            pool.SubmitTask([&sum, &done](int a, int b) {
+                sum += a + b;
+                ++done;
+            }, i, 1);
+        }
+        while (done < count) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        threads = pool.GetThreadSize();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    rusage after;
+    getrusage(RUSAGE_SELF, &after);
+    AsyncLog::GetInstance().Flush();
+    std::cout << count << " tasks, " << threads << " threads, " << (int64_t)(count / seconds)
+              << " tasks/s, voluntary cs/task " << (double)(after.ru_nvcsw - before.ru_nvcsw) / count
+              << ", involuntary cs/task " << (double)(after.ru_nivcsw - before.ru_nivcsw) / count << std::endl;
 }
 
-int main()
+// 带期限的关闭：2个线程、20个100ms的任务，250ms内没开始执行的取消，被取消任务的future得到默认值0
+void test7(ShutdownMode mode)
+{
+    ThreadPool pool;
+    pool.Start(2);
+    std::vector<TaskFuture<int>> results;
+    for (int i = 1; i <= 20; ++i) {
+        results.push_back(pool.SubmitTask([](int v) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            return v;
+        }, i));
+    }
+    auto    begin     = std::chrono::steady_clock::now();
+    size_t  cancelled = pool.Shutdown(mode, std::chrono::milliseconds(250));
+    auto    elapsed   = std::chrono::steady_clock::now() - begin;
+    int32_t finished  = 0;
+    for (auto& result : results) {
+        finished += result.Get() != 0;
+    }
+    bool rejected = pool.SubmitTask([]() { return 1; }).Get() == 0;
+    AsyncLog::GetInstance().Flush();
+    std::cout << "shutdown in " << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count()
+              << " ms, finished " << finished << ", cancelled " << cancelled << ", submit after shutdown "
+              << (rejected ? "rejected" : "accepted") << std::endl;
+}
+
+// ./threadpool [alloc [count] [none|compact|scatter|numa|numa-rr|cpus:0,2,4-7] | future | switches [count] |
+//               shutdown [drain|cancel]]
+int main(int argc, char* argv[])
 {
     // test1();
     // getchar();
     // test2();
     // getchar();
+    if (argc > 1 && std::string(argv[1]) == "alloc") {
+        PlacementPolicy placement;
+        if (argc > 3 && ParsePlacement(argv[3], placement)) {
+            CpuTopology::GetInstance().DumpJson(std::cout);
+        }
+        test4(argc > 2 ? atoi(argv[2]) : 100000, placement);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "switches") {
+        test6(argc > 2 ? atoi(argv[2]) : 1000000);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "shutdown") {
+        bool cancel = argc > 2 && std::string(argv[2]) == "cancel";
+        test7(cancel ? ShutdownMode::SHUTDOWN_CANCEL : ShutdownMode::SHUTDOWN_DRAIN);
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "future") {
+        test5();
+        AsyncLog::GetInstance().Flush();
+        return 0;
+    }
     test3();
+    AsyncLog::GetInstance().Flush();
+    LockProfiler::GetInstance().DumpJson(std::cout);
     return 0;
 }
\ No newline at end of file